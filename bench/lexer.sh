@@ -0,0 +1,41 @@
+#!/bin/bash
+# 比较 flex 生成的 lexer 和手写 lexer (LEXER=hand) 的速度
+# 用法: bench/lexer.sh [函数个数]  (默认 20000 个, 约 8MB)
+# 需要和 make 相同的环境 (flex, bison, libkoopa)
+set -e
+
+TOP_DIR=$(cd "$(dirname "$0")/.." && pwd)
+WORK_DIR=${WORK_DIR:-$TOP_DIR/build/bench}
+FUNCS=${1:-20000}
+mkdir -p "$WORK_DIR"
+
+# 生成输入: 大量带注释, 关键字, 各种进制常量和运算符的函数
+INPUT=$WORK_DIR/lexer_input.c
+awk -v n="$FUNCS" 'BEGIN {
+  for (i = 0; i < n; i++) {
+    printf "// function %d\n", i
+    printf "int func_%d(int arg_a, int arg_b) {\n", i
+    printf "  /* block comment for %d */\n", i
+    printf "  const int k = %d, m = 0x%x, o = 0%o;\n", i, i, i
+    printf "  int sum = 0, idx = 0;\n"
+    printf "  while (idx < arg_a && sum <= 1000 || idx != arg_b) {\n"
+    printf "    if (sum >= k) sum = sum - m; else sum = sum + o * idx %% 7;\n"
+    printf "    idx = idx + 1;\n"
+    printf "    if (idx == 100) break; else continue;\n"
+    printf "  }\n"
+    printf "  return sum;\n"
+    printf "}\n\n"
+  }
+  printf "int main() { return 0; }\n"
+}' > "$INPUT"
+echo "input: $INPUT ($(wc -c < "$INPUT") bytes)"
+
+for lexer in flex hand; do
+  make -s -C "$TOP_DIR" DEBUG=0 LEXER=$lexer BUILD_DIR="$WORK_DIR/$lexer" > /dev/null
+done
+
+for lexer in flex hand; do
+  echo "== $lexer"
+  time "$WORK_DIR/$lexer/compiler" -lex "$INPUT" -o "$WORK_DIR/$lexer.out"
+  echo "tokens: $(cat "$WORK_DIR/$lexer.out")"
+done
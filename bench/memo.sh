@@ -0,0 +1,54 @@
+#!/bin/bash
+# 比较 -O3 记忆化前后递归函数的运行时间
+# 用法: bench/memo.sh
+# 需要和 make 相同的环境 (flex, bison, libkoopa), 以及链接和运行 RISC-V 程序的工具:
+# ld.lld, qemu-riscv32-static 和 $CDE_LIBRARY_PATH/riscv32 下的 libsysy
+set -e
+
+TOP_DIR=$(cd "$(dirname "$0")/.." && pwd)
+WORK_DIR=${WORK_DIR:-$TOP_DIR/build/bench}
+LD=${LD:-ld.lld}
+QEMU=${QEMU:-qemu-riscv32-static}
+mkdir -p "$WORK_DIR"
+
+# 输入: 朴素写法下指数时间的 fib, 二项式系数和整数划分
+INPUT=$WORK_DIR/memo_input.c
+cat > "$INPUT" <<'SYSY'
+int fib(int n) {
+  if (n < 2) return n;
+  return fib(n - 1) + fib(n - 2);
+}
+
+int binom(int n, int k) {
+  if (k == 0) return 1;
+  if (k == n) return 1;
+  return binom(n - 1, k - 1) + binom(n - 1, k);
+}
+
+int part(int n, int m) {
+  if (n == 0) return 1;
+  if (n < 0) return 0;
+  if (m == 0) return 0;
+  return part(n - m, m) + part(n, m - 1);
+}
+
+int main() {
+  return (fib(32) + binom(26, 13) + part(90, 90)) % 256;
+}
+SYSY
+echo "input: $INPUT"
+
+make -s -C "$TOP_DIR" DEBUG=0 BUILD_DIR="$WORK_DIR/memo" > /dev/null
+
+for opt in -O0 -O3; do
+  "$WORK_DIR/memo/compiler" -obj "$INPUT" -o "$WORK_DIR/memo$opt.o" $opt
+  "$LD" "$WORK_DIR/memo$opt.o" -L"$CDE_LIBRARY_PATH/riscv32" -lsysy -o "$WORK_DIR/memo$opt"
+done
+
+for opt in -O0 -O3; do
+  echo "== $opt"
+  set +e
+  time "$QEMU" "$WORK_DIR/memo$opt"
+  echo "exit: $?"
+  set -e
+done
@@ -0,0 +1,104 @@
+#!/bin/bash
+# 检查 -rvv 向量化的结果: 同一个程序分别按标量和向量编译, 在 qemu 中用几种 VLEN 运行, 退出码必须相同
+# 用法: bench/rvv.sh, 或者 make check-rvv
+# 需要和 make 相同的环境 (flex, bison, libkoopa), 以及链接和运行 RISC-V 程序的工具:
+# ld.lld, 支持 V 扩展的 qemu-riscv32-static 和 $CDE_LIBRARY_PATH/riscv32 下的 libsysy
+# 缺少这些工具时输出原因并跳过, 退出码为 77, 不当作通过
+set -e
+
+TOP_DIR=$(cd "$(dirname "$0")/.." && pwd)
+WORK_DIR=${WORK_DIR:-$TOP_DIR/build/bench}
+LD=${LD:-ld.lld}
+QEMU=${QEMU:-qemu-riscv32-static}
+
+skip() {
+  echo "skip: $1"
+  exit 77
+}
+
+command -v "$LD" > /dev/null || skip "$LD not found"
+command -v "$QEMU" > /dev/null || skip "$QEMU not found"
+[ -f "$CDE_LIBRARY_PATH/riscv32/libsysy.a" ] || skip "libsysy not found in \$CDE_LIBRARY_PATH/riscv32"
+mkdir -p "$WORK_DIR"
+
+# 输入: 对归纳变量的各种归约, 包括负数, 除法取模, 全局变量, 外层循环里的内层循环和不执行的循环
+INPUT=$WORK_DIR/rvv_input.c
+cat > "$INPUT" <<'SYSY'
+int g;
+int h = 7;
+
+int squares(int n) {
+  int s = 0;
+  int i = 0;
+  while (i < n) {
+    s = s + i * i + 3;
+    i = i + 1;
+  }
+  return s;
+}
+
+int mixed(int lo, int hi, int c) {
+  int a = 5;
+  int b = 0;
+  int i = lo;
+  while (i < hi) {
+    a = a - i / c + (i % 7) * h;
+    b = (i - c) * (i + c) + b - 2;
+    g = g + i;
+    i = i + 1;
+  }
+  return a * 3 + b + i;
+}
+
+int triangle(int n) {
+  int s = 0;
+  int j = 0;
+  while (j < n) {
+    int i = 0;
+    while (i < j) {
+      s = s + i * j;
+      i = i + 1;
+    }
+    g = g + s % 13;
+    j = j + 1;
+  }
+  return s;
+}
+
+int main() {
+  int r = squares(3000000) + squares(0) + squares(1) + squares(7);
+  r = r + mixed(-20, 1000, 3) + mixed(5, 5, 1) + mixed(-2147483647, -2147483600, 5);
+  r = r + triangle(2000);
+  return (r + g) % 256;
+}
+SYSY
+echo "input: $INPUT"
+
+make -s -C "$TOP_DIR" DEBUG=0 RVV=1 BUILD_DIR="$WORK_DIR/rvv" > /dev/null
+
+# 先用一个空程序确认 qemu 支持 V 扩展
+echo "int main() { return 0; }" > "$WORK_DIR/rvv_probe.c"
+"$WORK_DIR/rvv/compiler" -obj "$WORK_DIR/rvv_probe.c" -o "$WORK_DIR/rvv_probe.o"
+"$LD" "$WORK_DIR/rvv_probe.o" -L"$CDE_LIBRARY_PATH/riscv32" -lsysy -o "$WORK_DIR/rvv_probe"
+"$QEMU" -cpu rv32,v=true,vlen=128 "$WORK_DIR/rvv_probe" > /dev/null 2>&1 || skip "$QEMU does not support the V extension"
+
+for flag in "" -rvv; do
+  "$WORK_DIR/rvv/compiler" -obj "$INPUT" -o "$WORK_DIR/rvv$flag.o" $flag
+  "$LD" "$WORK_DIR/rvv$flag.o" -L"$CDE_LIBRARY_PATH/riscv32" -lsysy -o "$WORK_DIR/rvv$flag"
+done
+
+set +e
+echo "== scalar"
+time "$QEMU" "$WORK_DIR/rvv"
+want=$?
+status=0
+for vlen in 128 256 1024; do
+  echo "== -rvv, vlen=$vlen"
+  time "$QEMU" -cpu rv32,v=true,vlen=$vlen "$WORK_DIR/rvv-rvv"
+  got=$?
+  if [ $got != $want ]; then
+    echo "mismatch: exit $got, scalar exit $want"
+    status=1
+  fi
+done
+exit $status
@@ -0,0 +1,137 @@
+#include <cstdlib>
+#include <map>
+#include <numeric>
+#include "alias.hpp"
+
+// 别名分析
+// 把指针拆成基址加偏移: 基址是 alloc, global alloc, 或者追溯不下去的指针 (数组参数 load 出来的值),
+// 偏移是常数加上若干 "系数 * 值" 的仿射式, getelemptr 和 getptr 逐层累加, 下标里的加减和乘常数也展开.
+// 不同的 alloc 和 global alloc 互不重叠; 追溯不下去的基址可能指向任何全局数组, 或者是调用者的数组,
+// 彼此之间也可能重叠, 但不会指向本函数的 alloc. SysY 不能取标量的地址, 标量只会通过它自己被访问.
+// 基址相同时比较偏移: 仿射部分相同就看常数差, 否则用 GCD 测试判断两者的差能否落在一个字以内
+
+// 仿射式: 常数 + sum(系数 * 值)
+struct affine_t {
+  long long constant = 0;
+  std::map<koopa_raw_value_t, long long> terms;
+
+  void Add(const affine_t &other, long long scale){
+    constant += other.constant * scale;
+    for (auto &t : other.terms){
+      terms[t.first] += t.second * scale;
+      if (terms[t.first] == 0) terms.erase(t.first);
+    }
+  }
+};
+
+// 指针 = 基址 + 字节偏移
+struct loc_t {
+  koopa_raw_value_t base;
+  affine_t offset;
+};
+
+static long long Size_of(koopa_raw_type_t ty){
+  switch (ty->tag){
+    case KOOPA_RTT_ARRAY:
+      return ty->data.array.len * Size_of(ty->data.array.base);
+    case KOOPA_RTT_UNIT:
+      return 0;
+    default:
+      return 4;
+  }
+}
+
+// 把整数值展开成仿射式
+static affine_t Affine(koopa_raw_value_t value){
+  affine_t res;
+  const auto &kind = value->kind;
+  if (kind.tag == KOOPA_RVT_INTEGER){
+    res.constant = kind.data.integer.value;
+    return res;
+  }
+  if (kind.tag == KOOPA_RVT_BINARY){
+    const auto &binary = kind.data.binary;
+    affine_t lhs = Affine(binary.lhs), rhs = Affine(binary.rhs);
+    switch (binary.op){
+      case KOOPA_RBO_ADD:
+        lhs.Add(rhs, 1);
+        return lhs;
+      case KOOPA_RBO_SUB:
+        lhs.Add(rhs, -1);
+        return lhs;
+      case KOOPA_RBO_MUL:
+        if (rhs.terms.empty()){
+          res.Add(lhs, rhs.constant);
+          return res;
+        }
+        if (lhs.terms.empty()){
+          res.Add(rhs, lhs.constant);
+          return res;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+  res.terms[value] = 1;
+  return res;
+}
+
+static loc_t Locate(koopa_raw_value_t ptr){
+  const auto &kind = ptr->kind;
+  loc_t loc;
+  switch (kind.tag){
+    case KOOPA_RVT_GET_ELEM_PTR: {
+      // src 指向数组, 结果指向它的第 index 个元素
+      loc = Locate(kind.data.get_elem_ptr.src);
+      auto array = kind.data.get_elem_ptr.src->ty->data.pointer.base;
+      loc.offset.Add(Affine(kind.data.get_elem_ptr.index), Size_of(array->data.array.base));
+      return loc;
+    }
+    case KOOPA_RVT_GET_PTR: {
+      // src 指向 T, 结果向后移动 index 个 T
+      loc = Locate(kind.data.get_ptr.src);
+      loc.offset.Add(Affine(kind.data.get_ptr.index), Size_of(kind.data.get_ptr.src->ty->data.pointer.base));
+      return loc;
+    }
+    default:
+      loc.base = ptr;
+      return loc;
+  }
+}
+
+static bool Is_object(koopa_raw_value_t base){
+  return base->kind.tag == KOOPA_RVT_ALLOC || base->kind.tag == KOOPA_RVT_GLOBAL_ALLOC;
+}
+
+static bool Is_scalar(koopa_raw_value_t base){
+  return Is_object(base) && base->ty->data.pointer.base->tag != KOOPA_RTT_ARRAY;
+}
+
+alias_t alias(koopa_raw_value_t a, koopa_raw_value_t b){
+  if (a == b) return alias_t::MUST;
+  loc_t la = Locate(a), lb = Locate(b);
+  if (la.base != lb.base){
+    if (Is_object(la.base) && Is_object(lb.base)) return alias_t::NO;
+    if (Is_scalar(la.base) || Is_scalar(lb.base)) return alias_t::NO;
+    if (la.base->kind.tag == KOOPA_RVT_ALLOC || lb.base->kind.tag == KOOPA_RVT_ALLOC) return alias_t::NO;
+    return alias_t::MAY;
+  }
+
+  // 同一个基址, 看偏移之差 d + sum(c * x) 能否落在 (-4, 4) 里
+  affine_t diff = la.offset;
+  diff.Add(lb.offset, -1);
+  long long d = diff.constant;
+  if (diff.terms.empty()){
+    if (d == 0) return alias_t::MUST;
+    return std::llabs(d) >= 4 ? alias_t::NO : alias_t::MAY;
+  }
+  long long g = 0;
+  for (auto &t : diff.terms) g = std::gcd(g, std::llabs(t.second));
+  long long r = ((d % g) + g) % g;
+  return r >= 4 && g - r >= 4 ? alias_t::NO : alias_t::MAY;
+}
+
+bool points_to_local(koopa_raw_value_t ptr){
+  return Locate(ptr).base->kind.tag == KOOPA_RVT_ALLOC;
+}
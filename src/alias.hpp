@@ -0,0 +1,17 @@
+#pragma once
+#include "koopa.h"
+
+// 两次访存的地址关系
+enum class alias_t {
+  // 一定不重叠
+  NO,
+  // 可能重叠
+  MAY,
+  // 一定是同一个字
+  MUST,
+};
+
+// 两个 i32 指针 a 和 b 上的访存是否可能访问同一个字
+alias_t alias(koopa_raw_value_t a, koopa_raw_value_t b);
+// 指针是否一定指向本函数的局部变量 (alloc), 调用者和其他函数都看不到
+bool points_to_local(koopa_raw_value_t ptr);
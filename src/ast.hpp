@@ -6,63 +6,157 @@
 #include <stack>
 #include <vector>
 #include <map>
+#include <memory>
+#include <string>
+#include <cstdint>
 #include "sym.hpp"
 
+// AST 的种类, 每个产生式 (每个 AST 类) 一种
+// 遍历时可以直接 switch 种类, 不必为每种遍历都加一个虚函数
+// 表达式内部的节点不是 AST 对象, 而是 exp_pool_t 中的下标, 种类为 exp_op_t
+enum class ast_kind_t : uint8_t {
+  TreeHead, CompUnit, Decl, ConstDecl, ConstDefArr, ConstDef, ConstExpMuti,
+  ConstInitVal, ConstInitValArr, VarDecl, VarDefArr, VarDef, InitVal, InitValArr,
+  FuncDef, FuncFParamArr, FuncFParam, Block, BlockItemArr, Stmt, Exp, LVal,
+  ExpMuti, ConstExp,
+};
+
+struct exp_pool_t;
+
+// 生成 Koopa IR 时的上下文, 代替原来在每个 Dump/Cal 之间传递的一串参数
+struct dump_ctx_t {
+  // 生成的 Koopa IR
+  std::string str;
+  // 最后一个临时变量的编号
+  int cnt = 0;
+  // 所在循环的编号, 栈顶为最内层循环
+  std::stack<int> loop_cur;
+  // 表达式求值的结果
+  std::stack<num_t> val_st;
+  // 预先声明的符号 (库函数), 语义分析时作为初始的符号表
+  std::map<std::string, sym_t> val_ma;
+  // 所有表达式的节点, 由 parse_file 填写
+  exp_pool_t *pool = nullptr;
+};
+
 // 所有 AST 的基类
 class BaseAST {
   public:
+    ast_kind_t kind;
+
+    explicit BaseAST(ast_kind_t kind) : kind(kind) {}
     virtual ~BaseAST() = default;
-    virtual int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) = 0;
-    virtual void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-                      std::stack<num_t>* val_st, int global,
-                      std::map<std::string, sym_t>* val_ma) const = 0;
+    virtual int Cal(dump_ctx_t &ctx) = 0;
+    virtual void Dump(dump_ctx_t &ctx, int global) const = 0;
 };
 
+// 表达式的 Dump 和 Cal 都交给这两个函数, 用显式的栈代替递归
+// 嵌套再深的表达式 (例如几万项的 a+a+...+a) 也只占用固定大小的本地栈
+inline void Dump_exp(const exp_pool_t &pool, uint32_t root, dump_ctx_t &ctx, int global);
+inline int Cal_exp(const exp_pool_t &pool, uint32_t root, dump_ctx_t &ctx);
+inline bool Returns(const BaseAST *node);
+
+// 操作数: 数值直接输出, 寄存器输出 %编号
+inline std::string Operand(const num_t &num){
+  char stmp[20];
+  if (num.valid == 1) sprintf(stmp, "%d", num.num_val);
+  else sprintf(stmp, "%%%d", num.num_val);
+  return stmp;
+}
+
+// 运算结果存入新的临时变量, 压栈
+inline void Push_result(dump_ctx_t &ctx){
+  num_t tmpnum;
+  ctx.cnt++;
+  tmpnum.num_val = ctx.cnt;
+  tmpnum.valid = 0;
+  ctx.val_st.push(tmpnum);
+}
+
+// 一元运算, 栈顶为操作数, 输出 "%n = prefix 操作数 suffix"
+inline void Emit_unary(dump_ctx_t &ctx, const char *prefix, const char *suffix){
+  num_t tmpnum = ctx.val_st.top();
+  ctx.val_st.pop();
+  char stmp[64];
+  sprintf(stmp, "  %%%d = %s%s%s\n", ctx.cnt+1, prefix, Operand(tmpnum).c_str(), suffix);
+  ctx.str += stmp;
+  Push_result(ctx);
+}
+
+// 二元运算, 栈顶为右操作数, 其下为左操作数
+inline void Emit_binary(dump_ctx_t &ctx, const char *op){
+  num_t tmpnum1 = ctx.val_st.top();
+  ctx.val_st.pop();
+  num_t tmpnum2 = ctx.val_st.top();
+  ctx.val_st.pop();
+  char stmp[64];
+  sprintf(stmp, "  %%%d = %s %s, %s\n", ctx.cnt+1, op,
+          Operand(tmpnum2).c_str(), Operand(tmpnum1).c_str());
+  ctx.str += stmp;
+  Push_result(ctx);
+}
+
+// 逻辑运算: 两个操作数先分别转成 0/1, 再按位 and/or
+inline void Emit_logic(dump_ctx_t &ctx, const char *op){
+  num_t tmpnum1 = ctx.val_st.top();
+  ctx.val_st.pop();
+  num_t tmpnum2 = ctx.val_st.top();
+  ctx.val_st.pop();
+  char stmp[64];
+  sprintf(stmp, "  %%%d = eq %s, 0\n", ctx.cnt+1, Operand(tmpnum2).c_str());
+  ctx.str += stmp;
+  ctx.cnt++;
+  sprintf(stmp, "  %%%d = eq %%%d, 0\n", ctx.cnt+1, ctx.cnt);
+  ctx.str += stmp;
+  ctx.cnt++;
+  sprintf(stmp, "  %%%d = eq %s, 0\n", ctx.cnt+1, Operand(tmpnum1).c_str());
+  ctx.str += stmp;
+  ctx.cnt++;
+  sprintf(stmp, "  %%%d = eq %%%d, 0\n", ctx.cnt+1, ctx.cnt);
+  ctx.str += stmp;
+  ctx.cnt++;
+  sprintf(stmp, "  %%%d = %s %%%d, %%%d\n", ctx.cnt+1, op, ctx.cnt, ctx.cnt-2);
+  ctx.str += stmp;
+  Push_result(ctx);
+}
+
 // TreeHead ::= CompUnit
 class TreeHeadAST : public BaseAST {
   public:
+    TreeHeadAST() : BaseAST(ast_kind_t::TreeHead) {}
+
     std::unique_ptr<BaseAST> comp_unit;
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override { return 0; }
+    int Cal(dump_ctx_t &ctx) override { return 0; }
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      comp_unit->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+    void Dump(dump_ctx_t &ctx, int global) const override {
+      comp_unit->Dump(ctx, global);
     }
 };
 
 // CompUnit ::= FuncDef | Decl | CompUnit FuncDef | CompUnit Decl
+// 所有 FuncDef 和 Decl 按出现顺序存放在 units 中, first 为 1 表示 FuncDef, 2 表示 Decl
 class CompUnitAST : public BaseAST {
   public:
-    std::unique_ptr<BaseAST> func_def;
-    std::unique_ptr<BaseAST> decl;
-    std::unique_ptr<BaseAST> comp_unit;
-    int mode;
-
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override { return 0; }
-
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      switch (mode){
-        case 1:
-          func_def->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 2:
-          decl->Dump(str, cnt, loop_cur, val_st, 1, val_ma);
-          break;
-        case 3:
-          comp_unit->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          func_def->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 4:
-          comp_unit->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          decl->Dump(str, cnt, loop_cur, val_st, 1, val_ma);
-          break;
-        default:
-          assert(false);
-          break;
+    CompUnitAST() : BaseAST(ast_kind_t::CompUnit) {}
+
+    std::vector<std::pair<int, std::unique_ptr<BaseAST>>> units;
+
+    int Cal(dump_ctx_t &ctx) override { return 0; }
+
+    void Dump(dump_ctx_t &ctx, int global) const override {
+      for (auto &unit : units){
+        switch (unit.first){
+          case 1:
+            unit.second->Dump(ctx, global);
+            break;
+          case 2:
+            unit.second->Dump(ctx, 1);
+            break;
+          default:
+            assert(false);
+            break;
+        }
       }
     }
 };
@@ -70,21 +164,21 @@ class CompUnitAST : public BaseAST {
 // Decl ::= ConstDecl | VarDecl
 class DeclAST : public BaseAST {
   public:
+    DeclAST() : BaseAST(ast_kind_t::Decl) {}
+
     std::unique_ptr<BaseAST> const_decl;
     std::unique_ptr<BaseAST> var_decl;
     int mode;
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override { return 0; }
+    int Cal(dump_ctx_t &ctx) override { return 0; }
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
+    void Dump(dump_ctx_t &ctx, int global) const override {
       switch (mode){
         case 1:
-          const_decl->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+          const_decl->Dump(ctx, global);
           break;
         case 2:
-          var_decl->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+          var_decl->Dump(ctx, global);
           break;
         default:
           assert(false);
@@ -96,40 +190,29 @@ class DeclAST : public BaseAST {
 // ConstDecl ::= CONST INT ConstDefArr ";"
 class ConstDeclAST : public BaseAST {
   public:
+    ConstDeclAST() : BaseAST(ast_kind_t::ConstDecl) {}
+
     std::unique_ptr<BaseAST> const_def_arr;
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override { return 0; }
+    int Cal(dump_ctx_t &ctx) override { return 0; }
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      const_def_arr->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+    void Dump(dump_ctx_t &ctx, int global) const override {
+      const_def_arr->Dump(ctx, global);
     }
 };
 
 // ConstDefArr ::= ConstDefArr "," ConstDef | ConstDef
 class ConstDefArrAST : public BaseAST {
   public:
-    std::unique_ptr<BaseAST> const_def_arr;
-    std::unique_ptr<BaseAST> const_def;
-    int mode;
+    ConstDefArrAST() : BaseAST(ast_kind_t::ConstDefArr) {}
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override { return 0; }
+    std::vector<std::unique_ptr<BaseAST>> const_defs;
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      switch (mode){
-        case 1:
-          const_def_arr->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          const_def->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 2:
-          const_def->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        default:
-          assert(false);
-          break;
+    int Cal(dump_ctx_t &ctx) override { return 0; }
+
+    void Dump(dump_ctx_t &ctx, int global) const override {
+      for (auto &item : const_defs){
+        item->Dump(ctx, global);
       }
     }
 };
@@ -138,57 +221,41 @@ class ConstDefArrAST : public BaseAST {
 //            | IDENT ConstExpMuti "=" ConstInitVal
 class ConstDefAST : public BaseAST {
   public:
+    ConstDefAST() : BaseAST(ast_kind_t::ConstDef) {}
+
     std::unique_ptr<BaseAST> const_init_val;
     std::unique_ptr<BaseAST> const_exp_muti;
     std::string ident;
     int mode;
+    // 常量的值在语义分析时求出, 不生成 IR
+    sym_t sym;
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override { return 0; }
+    int Cal(dump_ctx_t &ctx) override { return 0; }
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      sym_t sym;
-      int value;
-      switch (mode){
-        case 1:
-          sym.val_t = const_init_val->Cal(str, val_st, val_ma);
-          sym.type = 0;
-          (*val_ma)[ident] = sym;
-          break;
-        case 2:
-          value = const_exp_muti->Cal(str, val_st, val_ma);
-          sym.val_t = 0;
-          sym.type = 6;
-          sym.number = value;
-          (*val_ma)[ident] = sym;
-          break;
-        default:
-          assert(false);
-          break;
-      }
+    void Dump(dump_ctx_t &ctx, int global) const override {
+      assert(mode == 1 || mode == 2);
     }
 };
 
 // ConstExpMuti ::= "[" ConstExp "]" | ConstExpMuti "[" ConstExp "]";
 class ConstExpMutiAST : public BaseAST {
   public:
+    ConstExpMutiAST() : BaseAST(ast_kind_t::ConstExpMuti) {}
+
     std::unique_ptr<BaseAST> const_exp;
     std::unique_ptr<BaseAST> const_exp_muti;
     int mode;
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override { return 0; }
+    int Cal(dump_ctx_t &ctx) override { return 0; }
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
+    void Dump(dump_ctx_t &ctx, int global) const override {
       switch (mode){
         case 1:
-          const_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+          const_exp->Dump(ctx, global);
           break;
         case 2:
-          const_exp_muti->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          const_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+          const_exp_muti->Dump(ctx, global);
+          const_exp->Dump(ctx, global);
           break;
         default:
           assert(false);
@@ -199,15 +266,17 @@ class ConstExpMutiAST : public BaseAST {
 // ConstInitVal ::= ConstExp | "{" "}" | "{" ConstInitValArr "}"
 class ConstInitValAST : public BaseAST {
   public:
+    ConstInitValAST() : BaseAST(ast_kind_t::ConstInitVal) {}
+
     std::unique_ptr<BaseAST> const_exp;
     std::unique_ptr<BaseAST> const_init_val_arr;
     int mode;
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
+    int Cal(dump_ctx_t &ctx) override {
       int val = 0;
       switch (mode){
         case 1:
-          val = const_exp->Cal(str, val_st, val_ma);
+          val = const_exp->Cal(ctx);
           break;
         case 2:
           break;
@@ -220,12 +289,10 @@ class ConstInitValAST : public BaseAST {
       return val;
     }
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
+    void Dump(dump_ctx_t &ctx, int global) const override {
       switch (mode){
         case 1:
-          const_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+          const_exp->Dump(ctx, global);
           break;
         case 2:
           break;
@@ -241,25 +308,15 @@ class ConstInitValAST : public BaseAST {
 // ConstInitValArr ::= ConstInitVal | ConstInitValArr "," ConstInitVal
 class ConstInitValArrAST : public BaseAST {
   public:
-    std::unique_ptr<BaseAST> const_init_val;
-    std::unique_ptr<BaseAST> const_init_val_arr;
-    int mode;
+    ConstInitValArrAST() : BaseAST(ast_kind_t::ConstInitValArr) {}
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override { return 0; }
+    std::vector<std::unique_ptr<BaseAST>> const_init_vals;
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      switch (mode){
-        case 1:
-          const_init_val->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 2:
-          const_init_val_arr->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          const_init_val->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        default:
-          assert(false);
+    int Cal(dump_ctx_t &ctx) override { return 0; }
+
+    void Dump(dump_ctx_t &ctx, int global) const override {
+      for (auto &item : const_init_vals){
+        item->Dump(ctx, global);
       }
     }
 };
@@ -267,40 +324,29 @@ class ConstInitValArrAST : public BaseAST {
 // VarDecl ::= INT VarDefArr ";"
 class VarDeclAST : public BaseAST {
   public:
+    VarDeclAST() : BaseAST(ast_kind_t::VarDecl) {}
+
     std::unique_ptr<BaseAST> var_def_arr;
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override { return 0; }
+    int Cal(dump_ctx_t &ctx) override { return 0; }
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      var_def_arr->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+    void Dump(dump_ctx_t &ctx, int global) const override {
+      var_def_arr->Dump(ctx, global);
     }
 };
 
 // VarDefArr ::= VarDefArr "," VarDef | VarDef;
 class VarDefArrAST : public BaseAST {
   public:
-    std::unique_ptr<BaseAST> var_def_arr;
-    std::unique_ptr<BaseAST> var_def;
-    int mode;
+    VarDefArrAST() : BaseAST(ast_kind_t::VarDefArr) {}
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override { return 0; }
+    std::vector<std::unique_ptr<BaseAST>> var_defs;
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      switch (mode){
-        case 1:
-          var_def_arr->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          var_def->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 2:
-          var_def->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        default:
-          assert(false);
-          break;
+    int Cal(dump_ctx_t &ctx) override { return 0; }
+
+    void Dump(dump_ctx_t &ctx, int global) const override {
+      for (auto &item : var_defs){
+        item->Dump(ctx, global);
       }
     }
 };
@@ -309,65 +355,56 @@ class VarDefArrAST : public BaseAST {
 //          | IDENT "=" InitVal | IDENT ConstExpMuti "=" InitVal
 class VarDefAST : public BaseAST {
   public:
+    VarDefAST() : BaseAST(ast_kind_t::VarDef) {}
+
     std::unique_ptr<BaseAST> init_val;
     std::unique_ptr<BaseAST> const_exp_muti;
     std::string ident;
     int mode;
+    // 全局变量的初值在语义分析时求出, 局部变量的初值生成 IR 时才知道是否为常数
+    mutable sym_t sym;
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override { return 0; }
+    int Cal(dump_ctx_t &ctx) override { return 0; }
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
+    void Dump(dump_ctx_t &ctx, int global) const override {
       char stmp[50];
-      int tmpval;
-      sym_t sym;
       num_t tmpnum;
       switch (mode){
         case 1:
-          sym.val_t = 0;
-          sym.type = 1;
-          (*val_ma)[ident] = sym;
           if (global == 0){
             sprintf(stmp, "  @%s = alloc i32\n", ident.c_str());
-            strcat(str, stmp);
+            ctx.str += stmp;
             sprintf(stmp, "  store 0, @%s\n", ident.c_str());
-            strcat(str, stmp);
+            ctx.str += stmp;
           }
           else{
             sprintf(stmp, "global @%s = alloc i32, 0\n\n", ident.c_str());
-            strcat(str, stmp);
+            ctx.str += stmp;
           }
           break;
         case 2:
           break;
         case 3:
           if (global == 0){
-            init_val->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-            tmpnum = (*val_st).top();
-            (*val_st).pop();
+            init_val->Dump(ctx, global);
+            tmpnum = ctx.val_st.top();
+            ctx.val_st.pop();
             sprintf(stmp, "  @%s = alloc i32\n", ident.c_str());
-            strcat(str, stmp);
+            ctx.str += stmp;
             if (tmpnum.valid == 1){
               sym.val_t = tmpnum.num_val;
               sprintf(stmp, "  store %d, @%s\n", sym.val_t, ident.c_str());
-              strcat(str, stmp);
+              ctx.str += stmp;
             }
             else{
               sym.val_t = 0;
               sprintf(stmp, "  store %%%d, @%s\n", tmpnum.num_val, ident.c_str());
-              strcat(str, stmp);
+              ctx.str += stmp;
             }
-            sym.type = 1;
-            (*val_ma)[ident] = sym;
           }
           else{
-            tmpval = init_val->Cal(str, val_st, val_ma);
-            sprintf(stmp, "global @%s = alloc i32, %d\n\n", ident.c_str(), tmpval);
-            strcat(str, stmp);
-            sym.val_t = tmpval;
-            sym.type = 1;
-            (*val_ma)[ident] = sym;
+            sprintf(stmp, "global @%s = alloc i32, %d\n\n", ident.c_str(), sym.val_t);
+            ctx.str += stmp;
           }
           break;
         case 4:
@@ -382,15 +419,17 @@ class VarDefAST : public BaseAST {
 // InitVal ::= Exp | "{" "}" | "{" InitValArr "}"
 class InitValAST : public BaseAST {
   public:
+    InitValAST() : BaseAST(ast_kind_t::InitVal) {}
+
     std::unique_ptr<BaseAST> exp;
     std::unique_ptr<BaseAST> init_val_arr;
     int mode;
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
+    int Cal(dump_ctx_t &ctx) override {
       int val = 0;
       switch (mode){
         case 1:
-          val = exp->Cal(str, val_st, val_ma);
+          val = exp->Cal(ctx);
           break;
         case 2:
           break;
@@ -403,17 +442,15 @@ class InitValAST : public BaseAST {
       return val;
     }
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
+    void Dump(dump_ctx_t &ctx, int global) const override {
       switch (mode){
         case 1:
-          exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+          exp->Dump(ctx, global);
           break;
         case 2:
           break;
         case 3:
-          init_val_arr->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+          init_val_arr->Dump(ctx, global);
           break;
         default:
           assert(false);
@@ -425,26 +462,15 @@ class InitValAST : public BaseAST {
 // InitValArr ::= InitVal | InitValArr "," InitVal
 class InitValArrAST : public BaseAST {
   public:
-    std::unique_ptr<BaseAST> init_val;
-    std::unique_ptr<BaseAST> init_val_arr;
-    int mode;
+    InitValArrAST() : BaseAST(ast_kind_t::InitValArr) {}
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override { return 0; }
+    std::vector<std::unique_ptr<BaseAST>> init_vals;
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      switch (mode){
-        case 1:
-          init_val->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 2:
-          init_val_arr->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          init_val->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        default:
-          assert(false);
-          break;
+    int Cal(dump_ctx_t &ctx) override { return 0; }
+
+    void Dump(dump_ctx_t &ctx, int global) const override {
+      for (auto &item : init_vals){
+        item->Dump(ctx, global);
       }
     }
 };
@@ -455,78 +481,66 @@ class InitValArrAST : public BaseAST {
 //           | VOID IDENT "(" FuncFParamArr ")" Block
 class FuncDefAST : public BaseAST {
   public:
+    FuncDefAST() : BaseAST(ast_kind_t::FuncDef) {}
+
     std::string ident;
     std::unique_ptr<BaseAST> block;
     std::unique_ptr<BaseAST> func_fparam_arr;
     int mode;
+    sym_t sym;
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override { return 0; }
+    int Cal(dump_ctx_t &ctx) override { return 0; }
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
+    void Dump(dump_ctx_t &ctx, int global) const override {
       char stmp[50];
-      sym_t loop_sym;
       switch (mode){
         case 1:
           sprintf(stmp, "fun @%s(): i32 {\n", ident.c_str());
-          strcat(str, stmp);
+          ctx.str += stmp;
           sprintf(stmp, "%%entry:\n");
-          strcat(str, stmp);
-          loop_sym.type = 2;
-          loop_sym.val_t = 0;
-          (*val_ma)[ident] = loop_sym;
-          block->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+          ctx.str += stmp;
+          block->Dump(ctx, global);
           sprintf(stmp, "}\n\n");
-          strcat(str, stmp);
+          ctx.str += stmp;
           break;
         case 2:
           sprintf(stmp, "fun @%s() {\n", ident.c_str());
-          strcat(str, stmp);  
+          ctx.str += stmp;  
           sprintf(stmp, "%%entry:\n");
-          strcat(str, stmp);
-          loop_sym.type = 3;
-          loop_sym.val_t = 0;
-          (*val_ma)[ident] = loop_sym;
-          block->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          if (block->Cal(str, val_st, val_ma) == 3){
+          ctx.str += stmp;
+          block->Dump(ctx, global);
+          if (!Returns(block.get())){
             sprintf(stmp, "  ret\n");
-            strcat(str, stmp);
+            ctx.str += stmp;
           }
           sprintf(stmp, "}\n\n");
-          strcat(str, stmp);
+          ctx.str += stmp;
           break;
         case 3:
           sprintf(stmp, "fun @%s(", ident.c_str());
-          strcat(str, stmp);
-          loop_sym.type = 2;
-          loop_sym.val_t = 0;
-          (*val_ma)[ident] = loop_sym;
-          func_fparam_arr->Cal(str, val_st, val_ma);
+          ctx.str += stmp;
+          func_fparam_arr->Cal(ctx);
           sprintf(stmp, "): i32 {\n%%entry:\n");
-          strcat(str, stmp);
-          func_fparam_arr->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          block->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+          ctx.str += stmp;
+          func_fparam_arr->Dump(ctx, global);
+          block->Dump(ctx, global);
           sprintf(stmp, "}\n\n");
-          strcat(str, stmp);
+          ctx.str += stmp;
           break;
         case 4:
           sprintf(stmp, "fun @%s(", ident.c_str());
-          strcat(str, stmp);
-          loop_sym.type = 3;
-          loop_sym.val_t = 0;
-          (*val_ma)[ident] = loop_sym;
-          func_fparam_arr->Cal(str, val_st, val_ma);
+          ctx.str += stmp;
+          func_fparam_arr->Cal(ctx);
           sprintf(stmp, ") {\n%%entry:\n");
-          strcat(str, stmp);
-          func_fparam_arr->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          block->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          if (block->Cal(str, val_st, val_ma) == 3){
+          ctx.str += stmp;
+          func_fparam_arr->Dump(ctx, global);
+          block->Dump(ctx, global);
+          if (!Returns(block.get())){
             sprintf(stmp, "  ret\n");
-            strcat(str, stmp);
+            ctx.str += stmp;
           }
           sprintf(stmp, "}\n\n");
-          strcat(str, stmp);
+          ctx.str += stmp;
           break;
         default:
           assert(false);
@@ -538,43 +552,25 @@ class FuncDefAST : public BaseAST {
 // FuncFParamArr ::= FuncFParamArr "," FuncFParam | FuncFParam
 class FuncFParamArrAST : public BaseAST {
   public:
-    std::unique_ptr<BaseAST> func_fparam_arr;
-    std::unique_ptr<BaseAST> func_fparam;
-    int mode;
+    FuncFParamArrAST() : BaseAST(ast_kind_t::FuncFParamArr) {}
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
-      char stmp[20];
-      switch (mode){
-        case 1:
-          func_fparam_arr->Cal(str, val_st, val_ma);
+    std::vector<std::unique_ptr<BaseAST>> func_fparams;
+
+    int Cal(dump_ctx_t &ctx) override {
+      char stmp[64];
+      for (size_t i = 0; i < func_fparams.size(); ++i){
+        if (i > 0){
           sprintf(stmp, ", ");
-          strcat(str, stmp);
-          func_fparam->Cal(str, val_st, val_ma);
-          break;
-        case 2:
-          func_fparam->Cal(str, val_st, val_ma);
-          break;
-        default:
-          assert(false);
-          break;
+          ctx.str += stmp;
+        }
+        func_fparams[i]->Cal(ctx);
       }
       return 0;
     }
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      switch (mode){
-        case 1:
-          func_fparam_arr->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          func_fparam->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 2:
-          func_fparam->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        default:
-          assert(false);
-          break;
+    void Dump(dump_ctx_t &ctx, int global) const override {
+      for (auto &item : func_fparams){
+        item->Dump(ctx, global);
       }
     }
 };
@@ -582,78 +578,56 @@ class FuncFParamArrAST : public BaseAST {
 // FuncFParam ::= INT IDENT
 class FuncFParamAST : public BaseAST {
   public:
+    FuncFParamAST() : BaseAST(ast_kind_t::FuncFParam) {}
+
     std::string ident;
+    sym_t sym;
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
+    int Cal(dump_ctx_t &ctx) override {
       char stmp[50];
       sprintf(stmp, "@%s: i32", ident.c_str());
-      strcat(str, stmp);
+      ctx.str += stmp;
       return 0;
     }
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
+    void Dump(dump_ctx_t &ctx, int global) const override {
       char stmp[50];
       sprintf(stmp, "  %%%s = alloc i32\n", ident.c_str());
-      strcat(str, stmp);
+      ctx.str += stmp;
       sprintf(stmp, "  store @%s, %%%s\n", ident.c_str(), ident.c_str());
-      strcat(str, stmp);
-      sym_t tmp_sym;
-      tmp_sym.type = 5;
-      tmp_sym.val_t = 0;
-      (*val_ma)[ident] = tmp_sym;
+      ctx.str += stmp;
     }
 };
 
 // Block ::= "{" BlockItemArr "}"
 class BlockAST : public BaseAST {
   public:
+    BlockAST() : BaseAST(ast_kind_t::Block) {}
+
     std::unique_ptr<BaseAST> block_item_arr;
+    // 最后一条语句以 ret 结束
+    bool returns = false;
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
-      int val = block_item_arr->Cal(str, val_st, val_ma);
-      return val;
-    }
+    int Cal(dump_ctx_t &ctx) override { return 0; }
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      block_item_arr->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+    void Dump(dump_ctx_t &ctx, int global) const override {
+      block_item_arr->Dump(ctx, global);
     }
 };
 
 // BlockItemArr ::= BlockItemArr Decl | BlockItemArr Stmt | 
+// 所有 Decl 和 Stmt 按出现顺序存放在 items 中, first 为 1 表示 Decl, 2 表示 Stmt
 class BlockItemArrAST : public BaseAST {
   public:
-    std::unique_ptr<BaseAST> block_item_arr;
-    std::unique_ptr<BaseAST> decl;
-    std::unique_ptr<BaseAST> stmt;
-    int mode;
+    BlockItemArrAST() : BaseAST(ast_kind_t::BlockItemArr) {}
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
-      int val = mode;
-      return val;
-    }
+    std::vector<std::pair<int, std::unique_ptr<BaseAST>>> items;
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      // std::cout << "blockitemarr dump mode = " << mode << std::endl;
-      switch (mode){
-        case 1:
-          block_item_arr->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          decl->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 2:
-          block_item_arr->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          stmt->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 3:
-          break;
-        default:
-          assert(false);
-          break;
+    int Cal(dump_ctx_t &ctx) override { return 0; }
+
+    void Dump(dump_ctx_t &ctx, int global) const override {
+      for (auto &item : items){
+        item.second->Dump(ctx, global);
       }
     }
 };
@@ -671,6 +645,8 @@ class BlockItemArrAST : public BaseAST {
 //        | RETURN Exp ";"
 class StmtAST : public BaseAST {
   public:
+    StmtAST() : BaseAST(ast_kind_t::Stmt) {}
+
     // std::unique_ptr<BaseAST> lval;
     std::string ident;
     std::unique_ptr<BaseAST> exp;
@@ -678,193 +654,204 @@ class StmtAST : public BaseAST {
     std::unique_ptr<BaseAST> stmt;
     std::unique_ptr<BaseAST> else_stmt;
     int mode;
+    // 赋值语句左边的变量, 由语义分析填写
+    const sym_t *sym = nullptr;
+    // 语句以 ret 结束, 之后不用再跳转
+    bool returns = false;
+
+    int Cal(dump_ctx_t &ctx) override { return 0; }
+
+    // 求 while 的条件, 为真时跳到 %<label><cur>, 否则离开循环
+    void Dump_while_cond(dump_ctx_t &ctx, int global, const char *label, int cur) const {
+      char stmp[80];
+      exp->Dump(ctx, global);
+      num_t tmpnum = ctx.val_st.top();
+      ctx.val_st.pop();
+      if (tmpnum.valid == 1){
+        sprintf(stmp, "  br %d, %%%s%d, %%next%d\n\n", tmpnum.num_val, label, cur, cur);
+      }
+      else{
+        sprintf(stmp, "  br %%%d, %%%s%d, %%next%d\n\n", tmpnum.num_val, label, cur, cur);
+      }
+      ctx.str += stmp;
+    }
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override { return mode; }
-
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
+    void Dump(dump_ctx_t &ctx, int global) const override {
       char stmp[50];
       num_t tmpnum;
-      sym_t tmpsym;
-      int ret_value, value, cur, tmpval;
+      int ret_value, value, cur;
       switch (mode){
         case 1:
-          tmpsym = (*val_ma)[ident];
-          if (tmpsym.type == 1){
-            sprintf(stmp, "  %%%d = load @%s\n", cnt+1, ident.c_str());
-            cnt++;
-            strcat(str, stmp);
-            exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-            tmpnum = (*val_st).top();
-            (*val_st).pop();
+          if (sym != nullptr && sym->type == 1){
+            sprintf(stmp, "  %%%d = load @%s\n", ctx.cnt+1, ident.c_str());
+            ctx.cnt++;
+            ctx.str += stmp;
+            exp->Dump(ctx, global);
+            tmpnum = ctx.val_st.top();
+            ctx.val_st.pop();
             ret_value = tmpnum.num_val;
             if (tmpnum.valid == 1){
-              sprintf(stmp, "  %%%d = add 0, %d\n", cnt+1, ret_value);
-              strcat(str, stmp);
-              cnt++;
+              sprintf(stmp, "  %%%d = add 0, %d\n", ctx.cnt+1, ret_value);
+              ctx.str += stmp;
+              ctx.cnt++;
             }
-            sprintf(stmp, "  store %%%d, @%s\n", cnt, ident.c_str());
-            strcat(str, stmp);
+            sprintf(stmp, "  store %%%d, @%s\n", ctx.cnt, ident.c_str());
+            ctx.str += stmp;
           }
           else{
-            sprintf(stmp, "  %%%d = load %%%s\n", cnt+1, ident.c_str());
-            cnt++;
-            strcat(str, stmp);
-            exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-            tmpnum = (*val_st).top();
-            (*val_st).pop();
+            sprintf(stmp, "  %%%d = load %%%s\n", ctx.cnt+1, ident.c_str());
+            ctx.cnt++;
+            ctx.str += stmp;
+            exp->Dump(ctx, global);
+            tmpnum = ctx.val_st.top();
+            ctx.val_st.pop();
             ret_value = tmpnum.num_val;
             if (tmpnum.valid == 1){
-              sprintf(stmp, "  %%%d = add 0, %d\n", cnt+1, ret_value);
-              strcat(str, stmp);
-              cnt++;
+              sprintf(stmp, "  %%%d = add 0, %d\n", ctx.cnt+1, ret_value);
+              ctx.str += stmp;
+              ctx.cnt++;
             }
-            sprintf(stmp, "  store %%%d, @%s\n", cnt, ident.c_str());
-            strcat(str, stmp);
+            sprintf(stmp, "  store %%%d, @%s\n", ctx.cnt, ident.c_str());
+            ctx.str += stmp;
           }
           break;
         case 2:
           break;
         case 3:
-          exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+          exp->Dump(ctx, global);
           break;
         case 4:
-          block->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+          block->Dump(ctx, global);
           break;
         case 5:
-          exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum = (*val_st).top();
+          exp->Dump(ctx, global);
+          tmpnum = ctx.val_st.top();
           value = tmpnum.num_val;
-          (*val_st).pop();
-          cur = std::max(cnt, 0);
+          ctx.val_st.pop();
+          cur = std::max(ctx.cnt, 0);
           if (tmpnum.valid == 1){
             sprintf(stmp, "  br %d, %%then%d, %%next%d\n\n", value, cur, cur);
           }
           else{
             sprintf(stmp, "  br %%%d, %%then%d, %%next%d\n\n", value, cur, cur);
           }
-          strcat(str, stmp);
+          ctx.str += stmp;
 
           sprintf(stmp, "%%then%d:\n", cur);
-          strcat(str, stmp);
-          stmt->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          if (stmt->Cal(str, val_st, val_ma) != 11){
+          ctx.str += stmp;
+          stmt->Dump(ctx, global);
+          if (!Returns(stmt.get())){
             sprintf(stmp, "  jump %%next%d\n\n", cur);
           }
           else{
             sprintf(stmp, "\n");
           }
-          strcat(str, stmp);
+          ctx.str += stmp;
 
           sprintf(stmp, "%%next%d:\n", cur);
-          strcat(str, stmp);
+          ctx.str += stmp;
           break;
         case 6:
-          exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum = (*val_st).top();
+          exp->Dump(ctx, global);
+          tmpnum = ctx.val_st.top();
           value = tmpnum.num_val;
-          (*val_st).pop();
-          cur = std::max(cnt, 0);
+          ctx.val_st.pop();
+          cur = std::max(ctx.cnt, 0);
           if (tmpnum.valid == 1){
             sprintf(stmp, "  br %d, %%then%d, %%else%d\n\n", value, cur, cur);
           }
           else{
             sprintf(stmp, "  br %%%d, %%then%d, %%else%d\n\n", value, cur, cur);
           }
-          strcat(str, stmp);
+          ctx.str += stmp;
 
           sprintf(stmp, "%%then%d:\n", cur);
-          strcat(str, stmp);
-          stmt->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          if (stmt->Cal(str, val_st, val_ma) != 11){
+          ctx.str += stmp;
+          stmt->Dump(ctx, global);
+          if (!Returns(stmt.get())){
             sprintf(stmp, "  jump %%next%d\n\n", cur);
           }
           else{
             sprintf(stmp, "\n");
           }
-          strcat(str, stmp);
+          ctx.str += stmp;
 
           sprintf(stmp, "%%else%d:\n", cur);
-          strcat(str, stmp);
-          else_stmt->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          if (else_stmt->Cal(str, val_st, val_ma) != 11){
+          ctx.str += stmp;
+          else_stmt->Dump(ctx, global);
+          if (!Returns(else_stmt.get())){
             sprintf(stmp, "  jump %%next%d\n\n", cur);
           }
           else{
             sprintf(stmp, "\n");
           }
-          strcat(str, stmp);
+          ctx.str += stmp;
 
           sprintf(stmp, "%%next%d:\n", cur);
-          strcat(str, stmp);
+          ctx.str += stmp;
           break;
         case 7:
-          cur = std::max(cnt, 0);
-          (*loop_cur).push(cur);
-          sprintf(stmp, "  jump %%while_entry%d\n\n", cur);
-          strcat(str, stmp);
+          // 循环旋转成 do-while: 条件在进入循环前判断一次, 之后在循环体末尾的 while_entry 里判断,
+          // 每轮只执行一次跳回循环体的条件分支; while_pre 是循环的前置块
+          cur = std::max(ctx.cnt, 0);
+          ctx.loop_cur.push(cur);
+          Dump_while_cond(ctx, global, "while_pre", cur);
 
-          sprintf(stmp, "%%while_entry%d:\n", cur);
-          strcat(str, stmp);
-          exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum = (*val_st).top();
-          value = tmpnum.num_val;
-          (*val_st).pop();
-          if (tmpnum.valid == 1){
-            sprintf(stmp, "  br %d, %%while_body%d, %%next%d\n\n", value, cur, cur);
-          }
-          else{
-            sprintf(stmp, "  br %%%d, %%while_body%d, %%next%d\n\n", value, cur, cur);
-          }
-          strcat(str, stmp);
+          sprintf(stmp, "%%while_pre%d:\n", cur);
+          ctx.str += stmp;
+          sprintf(stmp, "  jump %%while_body%d\n\n", cur);
+          ctx.str += stmp;
 
           sprintf(stmp, "%%while_body%d:\n", cur);
-          strcat(str, stmp);
-          stmt->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpval = stmt->Cal(str, val_st, val_ma);
-          if (tmpval != 11){
+          ctx.str += stmp;
+          stmt->Dump(ctx, global);
+          if (!Returns(stmt.get())){
             sprintf(stmp, "  jump %%while_entry%d\n\n", cur);
           }
           else{
             sprintf(stmp, "\n");
           }
-          strcat(str, stmp);
+          ctx.str += stmp;
+
+          // continue 也跳到这里
+          sprintf(stmp, "%%while_entry%d:\n", cur);
+          ctx.str += stmp;
+          Dump_while_cond(ctx, global, "while_body", cur);
 
           sprintf(stmp, "%%next%d:\n", cur);
-          strcat(str, stmp);
-          (*loop_cur).pop();
+          ctx.str += stmp;
+          ctx.loop_cur.pop();
           break;
         case 8:
-          cur = (*loop_cur).top();
+          cur = ctx.loop_cur.top();
           sprintf(stmp, "  jump %%next%d\n\n", cur);
-          strcat(str, stmp);
+          ctx.str += stmp;
           sprintf(stmp, "%%while_body_%d:\n", cur);
-          strcat(str, stmp);
+          ctx.str += stmp;
           break;
         case 9:
-          cur = (*loop_cur).top();
+          cur = ctx.loop_cur.top();
           sprintf(stmp, "  jump %%while_entry%d\n\n", cur);
-          strcat(str, stmp);
+          ctx.str += stmp;
           sprintf(stmp, "%%while_body_%d:\n", cur);
-          strcat(str, stmp);
+          ctx.str += stmp;
           break;
         case 10:
           sprintf(stmp, "  ret\n");
-          strcat(str, stmp);
+          ctx.str += stmp;
           break;
         case 11:
-          exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum = (*val_st).top();
+          exp->Dump(ctx, global);
+          tmpnum = ctx.val_st.top();
           ret_value = tmpnum.num_val;
-          (*val_st).pop();
+          ctx.val_st.pop();
           if (tmpnum.valid == 1){
             sprintf(stmp, "  ret %d\n", ret_value);
           }
           else{
             sprintf(stmp, "  ret %%%d\n", ret_value);
           }
-          strcat(str, stmp);
+          ctx.str += stmp;
           break;
         default:
           assert(false);
@@ -873,38 +860,40 @@ class StmtAST : public BaseAST {
     }
 };
 
-// Exp ::= LorExp
+// Exp ::= LOrExp
+// 整个表达式的根, 表达式本身存放在 ctx.pool 中
 class ExpAST : public BaseAST {
   public:
-    std::unique_ptr<BaseAST> lor_exp;
+    ExpAST() : BaseAST(ast_kind_t::Exp) {}
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
-      int val = lor_exp->Cal(str, val_st, val_ma);
-      return val;
+    uint32_t root;
+
+    int Cal(dump_ctx_t &ctx) override {
+      return Cal_exp(*ctx.pool, root, ctx);
     }
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      lor_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+    void Dump(dump_ctx_t &ctx, int global) const override {
+      Dump_exp(*ctx.pool, root, ctx, global);
     }
 };
 
 // LVal ::= IDENT | IDENT ExpMuti
 class LValAST : public BaseAST {
   public:
+    LValAST() : BaseAST(ast_kind_t::LVal) {}
+
     std::string ident;
     std::unique_ptr<BaseAST> exp_muti;
     int mode;
+    // 标识符对应的符号, 由语义分析填写, 未声明时为空
+    const sym_t *sym = nullptr;
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
+    int Cal(dump_ctx_t &ctx) override {
       int val = 0;
-      sym_t sym;
       switch (mode){
         case 1:
-          assert((*val_ma).count(ident) == 1);
-          sym = (*val_ma)[ident];
-          val = sym.val_t;
+          assert(sym != nullptr);
+          val = sym->val_t;
           break;
         case 2:
           break;
@@ -914,35 +903,32 @@ class LValAST : public BaseAST {
       return val;
     }
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
+    void Dump(dump_ctx_t &ctx, int global) const override {
       char stmp[50];
       num_t tmpnum;
       switch (mode){
         case 1:
-          if ((*val_ma).count(ident) == 1){
-            sym_t sym = (*val_ma)[ident];
-            if (sym.type == 0){
-              tmpnum.num_val = sym.val_t;
+          if (sym != nullptr){
+            if (sym->type == 0){
+              tmpnum.num_val = sym->val_t;
               tmpnum.valid = 1;
-              (*val_st).push(tmpnum);
+              ctx.val_st.push(tmpnum);
             }
-            else if (sym.type == 1){
-              sprintf(stmp, "  %%%d = load @%s\n", cnt+1, ident.c_str());
-              cnt++;
-              strcat(str, stmp);
-              tmpnum.num_val = cnt;
+            else if (sym->type == 1){
+              sprintf(stmp, "  %%%d = load @%s\n", ctx.cnt+1, ident.c_str());
+              ctx.cnt++;
+              ctx.str += stmp;
+              tmpnum.num_val = ctx.cnt;
               tmpnum.valid = 0;
-              (*val_st).push(tmpnum);
+              ctx.val_st.push(tmpnum);
             }
             else{
-              sprintf(stmp, "  %%%d = load %%%s\n", cnt+1, ident.c_str());
-              cnt++;
-              strcat(str, stmp);
-              tmpnum.num_val = cnt;
+              sprintf(stmp, "  %%%d = load %%%s\n", ctx.cnt+1, ident.c_str());
+              ctx.cnt++;
+              ctx.str += stmp;
+              tmpnum.num_val = ctx.cnt;
               tmpnum.valid = 0;
-              (*val_st).push(tmpnum);
+              ctx.val_st.push(tmpnum);
            }
           }
           break;
@@ -958,22 +944,22 @@ class LValAST : public BaseAST {
 // ExpMuti ::= "[" Exp "]" | ExpMuti "[" Exp "]";
 class ExpMutiAST : public BaseAST {
   public:
+    ExpMutiAST() : BaseAST(ast_kind_t::ExpMuti) {}
+
     std::unique_ptr<BaseAST> exp;
     std::unique_ptr<BaseAST> exp_muti;
     int mode;
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override { return 0; }
+    int Cal(dump_ctx_t &ctx) override { return 0; }
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
+    void Dump(dump_ctx_t &ctx, int global) const override {
       switch (mode){
         case 1:
-          exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+          exp->Dump(ctx, global);
           break;
         case 2:
-          exp_muti->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+          exp_muti->Dump(ctx, global);
+          exp->Dump(ctx, global);
           break;
         default:
           assert(false);
@@ -982,1086 +968,424 @@ class ExpMutiAST : public BaseAST {
     }
 };
 
-// PrimaryExp ::= "(" Exp ")" | LVal | Number;
-class PrimaryExpAST : public BaseAST {
-  public:
-    std::unique_ptr<BaseAST> exp;
-    std::unique_ptr<BaseAST> lval;
-    int number, mode;
-
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
-      int val = 0;
-      switch (mode){
-        case 1:
-          val = exp->Cal(str, val_st, val_ma);
-          break;
-        case 2:
-          val = lval->Cal(str, val_st, val_ma);
-          break;
-        case 3:
-          val = number;
-          break;
-        default:
-          assert(false);
-          break;
-      }
-      return val;
-    }
-
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      switch (mode){
-        case 1:
-          exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 2:
-          lval->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 3:
-          num_t tmpnum;
-          tmpnum.num_val = number;
-          tmpnum.valid = 1;
-          (*val_st).push(tmpnum);
-          break;
-        default:
-          assert(false);
-          break;
-      }
-    }
+// 表达式节点的种类, 每种运算一种
+// 只起传递作用的产生式 (MulExp ::= UnaryExp, "(" Exp ")", "+" UnaryExp 等) 不生成节点, 直接沿用子表达式的下标
+enum class exp_op_t : uint8_t {
+  // 整数常量, lhs 为数值
+  NUMBER,
+  // 变量或常量, lhs 为 lvals 中的下标
+  LVAL,
+  // 函数调用, lhs 为 calls 中的下标
+  CALL,
+  // 一元运算, 操作数为 lhs
+  NEG, NOT,
+  // 二元运算, 左右操作数为 lhs 和 rhs
+  MUL, DIV, MOD, ADD, SUB, LT, GT, LE, GE, EQ, NE, AND, OR,
 };
 
-// Number ::= INT_CONST;
-class NumberAST : public BaseAST {
-  public:
-    int num;
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
-      return num;
-    }
+// 函数调用: 函数名, 被调用的函数 (由语义分析填写) 和每个实参表达式的根
+struct call_t {
+  std::string ident;
+  const sym_t *sym = nullptr;
+  std::vector<uint32_t> args;
+};
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      num_t tmpnum;
-      tmpnum.num_val = num;
-      tmpnum.valid = 1;
-      (*val_st).push(tmpnum);
-    }
+// 表达式节点池
+// 所有表达式的节点按结构体数组存放, 节点用 32 位下标互相引用, 每个节点只占 9 个字节,
+// 没有虚表, 也不需要为每个节点单独分配内存; 遍历时顺着数组访问, 不用追指针
+// 变量 (LVal) 和函数调用的附加信息另外存放, 节点里只记它们的下标
+struct exp_pool_t {
+  std::vector<exp_op_t> op;
+  std::vector<uint32_t> lhs;
+  std::vector<uint32_t> rhs;
+  std::vector<std::unique_ptr<LValAST>> lvals;
+  std::vector<call_t> calls;
+
+  uint32_t Add(exp_op_t kind, uint32_t l, uint32_t r = 0){
+    op.push_back(kind);
+    lhs.push_back(l);
+    rhs.push_back(r);
+    return op.size() - 1;
+  }
+
+  uint32_t Add_lval(LValAST *lval){
+    lvals.emplace_back(lval);
+    return Add(exp_op_t::LVAL, lvals.size() - 1);
+  }
+
+  uint32_t Add_call(){
+    calls.emplace_back();
+    return calls.size() - 1;
+  }
 };
 
-// UnaryExp ::= PrimaryExp
-//            | IDENT "(" ")"
-//            | IDENT "(" FuncRParamArr ")"
-//            | ("+" | "-" | "!") UnaryExp;
-class UnaryExpAST : public BaseAST {
+// ConstExp ::= Exp;
+class ConstExpAST : public BaseAST {
   public:
-    std::unique_ptr<BaseAST> primary_exp;
-    std::string ident;
-    std::unique_ptr<BaseAST> func_rparam_arr;
-    std::unique_ptr<BaseAST> unary_exp;
-    int mode;
+    ConstExpAST() : BaseAST(ast_kind_t::ConstExp) {}
 
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
-      int val = 0;
-      switch (mode){
-        case 1:
-          val = primary_exp->Cal(str, val_st, val_ma);
-          break;
-        case 2:
-          break;
-        case 3:
-          break;
-        case 4:
-          val = unary_exp->Cal(str, val_st, val_ma);
-          break;
-        case 5:
-          val = unary_exp->Cal(str, val_st, val_ma);
-          val = -val;
-          break;
-        case 6:
-          val = unary_exp->Cal(str, val_st, val_ma);
-          val = !val;
-          break;
-        default:
-          assert(false);
-          break;
-      }
-      return val;
+    std::unique_ptr<BaseAST> exp;
+
+    int Cal(dump_ctx_t &ctx) override {
+      return exp->Cal(ctx);
     }
 
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-        
-      char stmp[50];
-      num_t tmpnum;
-      sym_t tmp_loop;
-      int value;
-      switch (mode){
-        case 1:
-          primary_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 2:
-          tmp_loop = (*val_ma)[ident];
-          if (tmp_loop.type == 2){
-            sprintf(stmp, "  %%%d = call @%s()\n", cnt+1, ident.c_str());
-            cnt++;
-            tmpnum.num_val = cnt;
-            tmpnum.valid = 0;
-            (*val_st).push(tmpnum);
-          }
-          else if (tmp_loop.type == 3){
-            sprintf(stmp, "  call @%s()\n", ident.c_str());
-          }
-          strcat(str, stmp);
-          break;
-        case 3:
-          tmp_loop = (*val_ma)[ident];
-          if (tmp_loop.type == 2){
-            func_rparam_arr->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-            sprintf(stmp, "  %%%d = call @%s(", cnt+1, ident.c_str());
-            strcat(str, stmp);
-            cnt++;
-            func_rparam_arr->Cal(str, val_st, val_ma);
-            sprintf(stmp, ")\n");
-            tmpnum.num_val = cnt;
-            tmpnum.valid = 0;
-            (*val_st).push(tmpnum);
-          }
-          else if (tmp_loop.type == 3){
-            func_rparam_arr->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-            sprintf(stmp, "  call @%s(", ident.c_str());
-            strcat(str, stmp);
-            func_rparam_arr->Cal(str, val_st, val_ma);
-            sprintf(stmp, ")\n");
-          }
-          strcat(str, stmp);
-          break;
-        case 4:
-          unary_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 5:
-          // std::cout << "unary_exp dump5" << std::endl;
-          unary_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum = (*val_st).top();
-          value = tmpnum.num_val;
-          (*val_st).pop();
-          if (tmpnum.valid == 1){
-            sprintf(stmp, "  %%%d = sub 0, %d\n", cnt+1, value);
-          }
-          else{
-            sprintf(stmp, "  %%%d = sub 0, %%%d\n", cnt+1, value);
-          }
-          cnt++;
-          strcat(str, stmp);
-          tmpnum.valid = 0;
-          tmpnum.num_val = cnt;
-          (*val_st).push(tmpnum);
-          break;
-        case 6:
-          // std::cout << "unary_exp dump6" << std::endl;
-          unary_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum = (*val_st).top();
-          value = tmpnum.num_val;
-          (*val_st).pop();
-          if (tmpnum.valid == 1){
-            sprintf(stmp, "  %%%d = eq %d, 0\n", cnt+1, value);
-          }
-          else{
-            sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, value);
-          }
-          cnt++;
-          strcat(str, stmp);
-          tmpnum.valid = 0;
-          tmpnum.num_val = cnt;
-          (*val_st).push(tmpnum);
-          break;
-        default:
-          assert(false);
-          break;
-      }
+    void Dump(dump_ctx_t &ctx, int global) const override {
+      exp->Dump(ctx, global);
     }
 };
 
-// FuncRParamArr ::= FuncRParamArr "," FuncRParam | FuncRParam;
-class FuncRParamArrAST : public BaseAST {
-  public:
-    std::unique_ptr<BaseAST> func_rparam_arr;
-    std::unique_ptr<BaseAST> func_rparam;
-    int mode;
-
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
-      char stmp[20];
-      switch (mode){
-        case 1:
-          // std::cout << "func_rparam_arr cal1" << std::endl;
-          func_rparam_arr->Cal(str, val_st, val_ma);
-          sprintf(stmp, ", ");
-          strcat(str, stmp);
-          func_rparam->Cal(str, val_st, val_ma);
-          break;
-        case 2:
-          // std::cout << "func_rparam_arr cal2" << std::endl;
-          func_rparam->Cal(str, val_st, val_ma);
-          break;
-        default:
-          assert(false);
-          break;
-      }
-      return 0;
+// 语句或块以 ret 结束, 由语义分析填写
+inline bool Returns(const BaseAST *node){
+  if (node->kind == ast_kind_t::Block) return static_cast<const BlockAST *>(node)->returns;
+  if (node->kind == ast_kind_t::Stmt) return static_cast<const StmtAST *>(node)->returns;
+  return false;
+}
+
+// 按源程序顺序访问一个节点的所有子节点
+// 供分析等不生成 IR 的遍历使用, 通过种类分派, 不需要额外的虚函数
+template <typename F>
+void For_each_child(const BaseAST *node, F &&f){
+  auto visit = [&](const std::unique_ptr<BaseAST> &child){
+    if (child) f(child.get());
+  };
+  switch (node->kind){
+    case ast_kind_t::TreeHead: {
+      auto ast = static_cast<const TreeHeadAST *>(node);
+      visit(ast->comp_unit);
+      break;
     }
-
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      switch (mode){
-        case 1:
-          func_rparam->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          func_rparam_arr->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 2:
-          func_rparam->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        default:
-          assert(false);
-          break;
-      }
+    case ast_kind_t::CompUnit: {
+      auto ast = static_cast<const CompUnitAST *>(node);
+      for (auto &item : ast->units) visit(item.second);
+      break;
     }
-};
-
-// FuncRParam ::= Exp;
-class FuncRParamAST : public BaseAST {
-  public:
-    std::unique_ptr<BaseAST> exp;
-
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
-      num_t tmpnum= (*val_st).top();
-      int value = tmpnum.num_val;
-      (*val_st).pop();
-      char stmp[20];
-      if (tmpnum.valid == 1){
-        sprintf(stmp, "%d", value);
-      }
-      else{
-        sprintf(stmp, "%%%d", value);
-      }
-      strcat(str, stmp);
-      return 0;
+    case ast_kind_t::Decl: {
+      auto ast = static_cast<const DeclAST *>(node);
+      visit(ast->const_decl);
+      visit(ast->var_decl);
+      break;
     }
-
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+    case ast_kind_t::ConstDecl: {
+      auto ast = static_cast<const ConstDeclAST *>(node);
+      visit(ast->const_def_arr);
+      break;
     }
-};
-
-// MulExp ::= UnaryExp | MulExp ("*" | "/" | "%") UnaryExp;
-class MulExpAST : public BaseAST {
-  public:
-    std::unique_ptr<BaseAST> unary_exp;
-    std::unique_ptr<BaseAST> mul_exp;
-    int mode;
-
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
-      int val = 0, valx, valy;
-      switch (mode){
-        case 1:
-          val = unary_exp->Cal(str, val_st, val_ma);
-          break;
-        case 2:
-          valx = mul_exp->Cal(str, val_st, val_ma);
-          valy = unary_exp->Cal(str, val_st, val_ma);
-          val = valx * valy;
-          break;
-        case 3:
-          valx = mul_exp->Cal(str, val_st, val_ma);
-          valy = unary_exp->Cal(str, val_st, val_ma);
-          val = valx / valy;
-          break;
-        case 4:
-          valx = mul_exp->Cal(str, val_st, val_ma);
-          valy = unary_exp->Cal(str, val_st, val_ma);
-          val = valx % valy;
-          break;
-        default:
-          assert(false);
-          break;
-      }
-      return val;
+    case ast_kind_t::ConstDefArr: {
+      auto ast = static_cast<const ConstDefArrAST *>(node);
+      for (auto &item : ast->const_defs) visit(item);
+      break;
     }
-
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      num_t tmpnum1, tmpnum2;
-      int value1, value2;
-      char stmp[20];
-      switch (mode){
-        case 1:
-          // std::cout << "mul_exp dump1" << std::endl;
-          unary_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 2:
-          // std::cout << "mul_exp dump2" << std::endl;
-          mul_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          unary_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum1 = (*val_st).top();
-          value1 = tmpnum1.num_val;
-          (*val_st).pop();
-          tmpnum2 = (*val_st).top();
-          value2 = tmpnum2.num_val;
-          (*val_st).pop();
-          if (tmpnum1.valid == 1){
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = mul %d, %d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = mul %%%d, %d\n", cnt+1, value2, value1);
-            }
-          }
-          else{
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = mul %d, %%%d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = mul %%%d, %%%d\n", cnt+1, value2, value1);
-            }
-          }
-          strcat(str, stmp);
-          cnt++;
-          tmpnum1.num_val = cnt;
-          tmpnum1.valid = 0;
-          (*val_st).push(tmpnum1);
-          break;
-        case 3:
-          // std::cout << "mul_exp dump3" << std::endl;
-          mul_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          unary_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum1 = (*val_st).top();
-          value1 = tmpnum1.num_val;
-          (*val_st).pop();
-          tmpnum2 = (*val_st).top();
-          value2 = tmpnum2.num_val;
-          (*val_st).pop();
-          if (tmpnum1.valid == 1){
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = div %d, %d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = div %%%d, %d\n", cnt+1, value2, value1);
-            }
-          }
-          else{
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = div %d, %%%d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = div %%%d, %%%d\n", cnt+1, value2, value1);
-            }
-          }
-          strcat(str, stmp);
-          cnt++;
-          tmpnum1.num_val = cnt;
-          tmpnum1.valid = 0;
-          (*val_st).push(tmpnum1);
-          break;
-        case 4:
-          // std::cout << "mul_exp dump4" << std::endl;
-          mul_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          unary_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum1 = (*val_st).top();
-          value1 = tmpnum1.num_val;
-          (*val_st).pop();
-          tmpnum2 = (*val_st).top();
-          value2 = tmpnum2.num_val;
-          (*val_st).pop();
-          if (tmpnum1.valid == 1){
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = mod %d, %d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = mod %%%d, %d\n", cnt+1, value2, value1);
-            }
-          }
-          else{
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = mod %d, %%%d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = mod %%%d, %%%d\n", cnt+1, value2, value1);
-            }
-          }
-          strcat(str, stmp);
-          cnt++;
-          tmpnum1.num_val = cnt;
-          tmpnum1.valid = 0;
-          (*val_st).push(tmpnum1);
-          break;
-        default:
-          assert(false);
-          break;
-      }
+    case ast_kind_t::ConstDef: {
+      auto ast = static_cast<const ConstDefAST *>(node);
+      visit(ast->const_exp_muti);
+      visit(ast->const_init_val);
+      break;
     }
-};
-
-// AddExp ::= MulExp | AddExp ("+" | "-") MulExp;
-class AddExpAST : public BaseAST {
-  public:
-    std::unique_ptr<BaseAST> mul_exp;
-    std::unique_ptr<BaseAST> add_exp;
-    int mode;
-
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
-      int val = 0, valx, valy;
-      switch (mode){
-        case 1:
-          val = mul_exp->Cal(str, val_st, val_ma);
-          break;
-        case 2:
-          valx = add_exp->Cal(str, val_st, val_ma);
-          valy = mul_exp->Cal(str, val_st, val_ma);
-          val = valx + valy;
-          break;
-        case 3:
-          valx = add_exp->Cal(str, val_st, val_ma);
-          valy = mul_exp->Cal(str, val_st, val_ma);
-          val = valx - valy;
-          break;
-        default:
-          assert(false);
-          break;
-      }
-      return val;
+    case ast_kind_t::ConstExpMuti: {
+      auto ast = static_cast<const ConstExpMutiAST *>(node);
+      visit(ast->const_exp_muti);
+      visit(ast->const_exp);
+      break;
     }
-
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      num_t tmpnum1, tmpnum2;
-      int value1, value2;
-      char stmp[20];
-      switch (mode){
-        case 1:
-          // std::cout << "add_exp dump1" << std::endl;
-          mul_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 2:
-          // std::cout << "add_exp dump2" << std::endl;
-          add_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          mul_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum1 = (*val_st).top();
-          value1 = tmpnum1.num_val;
-          (*val_st).pop();
-          tmpnum2 = (*val_st).top();
-          value2 = tmpnum2.num_val;
-          (*val_st).pop();
-          if (tmpnum1.valid == 1){
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = add %d, %d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = add %%%d, %d\n", cnt+1, value2, value1);
-            }
-          }
-          else{
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = add %d, %%%d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = add %%%d, %%%d\n", cnt+1, value2, value1);
-            }
-          }
-          strcat(str, stmp);
-          cnt++;
-          tmpnum1.num_val = cnt;
-          tmpnum1.valid = 0;
-          (*val_st).push(tmpnum1);
-          break;
-        case 3:
-          // std::cout << "add_exp dump3" << std::endl;
-          add_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          mul_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum1 = (*val_st).top();
-          value1 = tmpnum1.num_val;
-          (*val_st).pop();
-          tmpnum2 = (*val_st).top();
-          value2 = tmpnum2.num_val;
-          (*val_st).pop();
-          if (tmpnum1.valid == 1){
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = sub %d, %d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = sub %%%d, %d\n", cnt+1, value2, value1);
-            }
-          }
-          else{
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = sub %d, %%%d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = sub %%%d, %%%d\n", cnt+1, value2, value1);
-            }
-          }
-          strcat(str, stmp);
-          cnt++;
-          tmpnum1.num_val = cnt;
-          tmpnum1.valid = 0;
-          (*val_st).push(tmpnum1);
-          break;
-        default:
-          assert(false);
-          break;
-      }
+    case ast_kind_t::ConstInitVal: {
+      auto ast = static_cast<const ConstInitValAST *>(node);
+      visit(ast->const_exp);
+      visit(ast->const_init_val_arr);
+      break;
     }
-};
-
-// RelExp ::= AddExp | RelExp ("<" | ">" | "<=" | ">=") AddExp;
-class RelExpAST : public BaseAST {
-  public:
-    std::unique_ptr<BaseAST> add_exp;
-    std::unique_ptr<BaseAST> rel_exp;
-    int mode;
-    
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
-      int val = 0, valx, valy;
-      switch (mode){
-        case 1:
-          val = add_exp->Cal(str, val_st, val_ma);
-          break;
-        case 2:
-          valx = rel_exp->Cal(str, val_st, val_ma);
-          valy = add_exp->Cal(str, val_st, val_ma);
-          val = valx < valy;
-          break;
-        case 3:
-          valx = rel_exp->Cal(str, val_st, val_ma);
-          valy = add_exp->Cal(str, val_st, val_ma);
-          val = valx > valy;
-          break;
-        case 4:
-          valx = rel_exp->Cal(str, val_st, val_ma);
-          valy = add_exp->Cal(str, val_st, val_ma);
-          val = valx <= valy;
-          break;
-        case 5:
-          valx = rel_exp->Cal(str, val_st, val_ma);
-          valy = add_exp->Cal(str, val_st, val_ma);
-          val = valx >= valy;
-          break;
-        default:
-          assert(false);
-          break;
-      }
-      return val;
+    case ast_kind_t::ConstInitValArr: {
+      auto ast = static_cast<const ConstInitValArrAST *>(node);
+      for (auto &item : ast->const_init_vals) visit(item);
+      break;
     }
-
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      num_t tmpnum1, tmpnum2;
-      int value1, value2;
-      char stmp[20];
-      switch (mode){
-        case 1:
-          add_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 2:
-          rel_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          add_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum1 = (*val_st).top();
-          value1 = tmpnum1.num_val;
-          (*val_st).pop();
-          tmpnum2 = (*val_st).top();
-          value2 = tmpnum2.num_val;
-          (*val_st).pop();
-          if (tmpnum1.valid == 1){
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = lt %d, %d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = lt %%%d, %d\n", cnt+1, value2, value1);
-            }
-          }
-          else{
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = lt %d, %%%d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = lt %%%d, %%%d\n", cnt+1, value2, value1);
-            }
-          }
-          strcat(str, stmp);
-          cnt++;
-          tmpnum1.num_val = cnt;
-          tmpnum1.valid = 0;
-          (*val_st).push(tmpnum1);
-          break;
-        case 3:
-          rel_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          add_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum1 = (*val_st).top();
-          value1 = tmpnum1.num_val;
-          (*val_st).pop();
-          tmpnum2 = (*val_st).top();
-          value2 = tmpnum2.num_val;
-          (*val_st).pop();
-          if (tmpnum1.valid == 1){
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = gt %d, %d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = gt %%%d, %d\n", cnt+1, value2, value1);
-            }
-          }
-          else{
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = gt %d, %%%d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = gt %%%d, %%%d\n", cnt+1, value2, value1);
-            }
-          }
-          strcat(str, stmp);
-          cnt++;
-          tmpnum1.num_val = cnt;
-          tmpnum1.valid = 0;
-          (*val_st).push(tmpnum1);
-          break;
-        case 4:
-          rel_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          add_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum1 = (*val_st).top();
-          value1 = tmpnum1.num_val;
-          (*val_st).pop();
-          tmpnum2 = (*val_st).top();
-          value2 = tmpnum2.num_val;
-          (*val_st).pop();
-          if (tmpnum1.valid == 1){
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = le %d, %d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = le %%%d, %d\n", cnt+1, value2, value1);
-            }
-          }
-          else{
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = le %d, %%%d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = le %%%d, %%%d\n", cnt+1, value2, value1);
-            }
-          }
-          strcat(str, stmp);
-          cnt++;
-          tmpnum1.num_val = cnt;
-          tmpnum1.valid = 0;
-          (*val_st).push(tmpnum1);
-          break;
-        case 5:
-          rel_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          add_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum1 = (*val_st).top();
-          value1 = tmpnum1.num_val;
-          (*val_st).pop();
-          tmpnum2 = (*val_st).top();
-          value2 = tmpnum2.num_val;
-          (*val_st).pop();
-          if (tmpnum1.valid == 1){
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = ge %d, %d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = ge %%%d, %d\n", cnt+1, value2, value1);
-            }
-          }
-          else{
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = ge %d, %%%d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = ge %%%d, %%%d\n", cnt+1, value2, value1);
-            }
-          }
-          strcat(str, stmp);
-          cnt++;
-          tmpnum1.num_val = cnt;
-          tmpnum1.valid = 0;
-          (*val_st).push(tmpnum1);
-          break;
-        default:
-          assert(false);
-          break;
-      }
+    case ast_kind_t::VarDecl: {
+      auto ast = static_cast<const VarDeclAST *>(node);
+      visit(ast->var_def_arr);
+      break;
     }
-};
-
-// EqExp ::= RelExp | EqExp ("==" | "!=") RelExp;
-class EqExpAST : public BaseAST {
-  public:
-    std::unique_ptr<BaseAST> rel_exp;
-    std::unique_ptr<BaseAST> eq_exp;
-    int mode;
-
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
-      int val = 0, valx, valy;
-      switch (mode){
-        case 1:
-          val = rel_exp->Cal(str, val_st, val_ma);
-          break;
-        case 2:
-          valx = eq_exp->Cal(str, val_st, val_ma);
-          valy = rel_exp->Cal(str, val_st, val_ma);
-          val = valx == valy;
-          break;
-        case 3:
-          valx = eq_exp->Cal(str, val_st, val_ma);
-          valy = rel_exp->Cal(str, val_st, val_ma);
-          val = valx != valy;
-          break;
-        default:
-          assert(false);
-          break;
-      }
-      return val;
+    case ast_kind_t::VarDefArr: {
+      auto ast = static_cast<const VarDefArrAST *>(node);
+      for (auto &item : ast->var_defs) visit(item);
+      break;
     }
-
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      num_t tmpnum1, tmpnum2;
-      int value1, value2;
-      char stmp[20];
-      switch (mode){
-        case 1:
-          rel_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 2:
-          eq_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          rel_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum1 = (*val_st).top();
-          value1 = tmpnum1.num_val;
-          (*val_st).pop();
-          tmpnum2 = (*val_st).top();
-          value2 = tmpnum2.num_val;
-          (*val_st).pop();
-          if (tmpnum1.valid == 1){
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = eq %d, %d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = eq %%%d, %d\n", cnt+1, value2, value1);
-            }
-          }
-          else{
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = eq %d, %%%d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = eq %%%d, %%%d\n", cnt+1, value2, value1);
-            }
-          }
-          strcat(str, stmp);
-          cnt++;
-          tmpnum1.num_val = cnt;
-          tmpnum1.valid = 0;
-          (*val_st).push(tmpnum1);
-          break;
-        case 3:
-          eq_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          rel_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum1 = (*val_st).top();
-          value1 = tmpnum1.num_val;
-          (*val_st).pop();
-          tmpnum2 = (*val_st).top();
-          value2 = tmpnum2.num_val;
-          (*val_st).pop();
-          if (tmpnum1.valid == 1){
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = ne %d, %d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = ne %%%d, %d\n", cnt+1, value2, value1);
-            }
-          }
-          else{
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = ne %d, %%%d\n", cnt+1, value2, value1);
-            }
-            else{
-              sprintf(stmp, "  %%%d = ne %%%d, %%%d\n", cnt+1, value2, value1);
-            }
-          }
-          strcat(str, stmp);
-          cnt++;
-          tmpnum1.num_val = cnt;
-          tmpnum1.valid = 0;
-          (*val_st).push(tmpnum1);
-          break;
-        default:
-          assert(false);
-          break;
-      }
+    case ast_kind_t::VarDef: {
+      auto ast = static_cast<const VarDefAST *>(node);
+      visit(ast->const_exp_muti);
+      visit(ast->init_val);
+      break;
     }
-};
-
-// LAndExp ::= EqExp | LAndExp "&&" EqExp;
-class LAndExpAST : public BaseAST {
-  public:
-    std::unique_ptr<BaseAST> eq_exp;
-    std::unique_ptr<BaseAST> land_exp;
-    int mode;
-
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
-      int val = 0, valx, valy;
-      switch (mode){
-        case 1:
-          val = eq_exp->Cal(str, val_st, val_ma);
-          break;
-        case 2:
-          valx = land_exp->Cal(str, val_st, val_ma);
-          valy = eq_exp->Cal(str, val_st, val_ma);
-          val = valx && valy;
-          break;
-        default:
-          assert(false);
-          break;
-      }
-      return val;
+    case ast_kind_t::InitVal: {
+      auto ast = static_cast<const InitValAST *>(node);
+      visit(ast->exp);
+      visit(ast->init_val_arr);
+      break;
     }
-
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      num_t tmpnum1, tmpnum2;
-      int value1, value2;
-      char stmp[20];
-      switch (mode){
-        case 1:
-          eq_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 2:
-          land_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          eq_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum1 = (*val_st).top();
-          value1 = tmpnum1.num_val;
-          (*val_st).pop();
-          tmpnum2 = (*val_st).top();
-          value2 = tmpnum2.num_val;
-          (*val_st).pop();
-          if (tmpnum1.valid == 1){
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = eq %d, 0\n", cnt+1, value2);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, cnt);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %d, 0\n", cnt+1, value1);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, cnt);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = and %%%d, %%%d\n", cnt+1, cnt, cnt-2);
-            }
-            else{
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, value2);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, cnt);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %d, 0\n", cnt+1, value1);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, cnt);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = and %%%d, %%%d\n", cnt+1, cnt, cnt-2);
-            }
-          }
-          else{
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = eq %d, 0\n", cnt+1, value2);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, cnt);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, value1);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, cnt);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = and %%%d, %%%d\n", cnt+1, cnt, cnt-2);
-            }
-            else{
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, value2);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, cnt);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, value1);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, cnt);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = and %%%d, %%%d\n", cnt+1, cnt, cnt-2);
-            }
-          }
-          strcat(str, stmp);
-          cnt++;
-          tmpnum1.num_val = cnt;
-          tmpnum1.valid = 0;
-          (*val_st).push(tmpnum1);
-          break;
-        default:
-          assert(false);
-          break;
-      }
+    case ast_kind_t::InitValArr: {
+      auto ast = static_cast<const InitValArrAST *>(node);
+      for (auto &item : ast->init_vals) visit(item);
+      break;
     }
-};
-
-// LOrExp ::= LAndExp | LOrExp "||" LAndExp;
-class LOrExpAST : public BaseAST {
-  public:
-    std::unique_ptr<BaseAST> land_exp;
-    std::unique_ptr<BaseAST> lor_exp;
-    int mode;
-
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
-      int val = 0, valx, valy;
-      switch (mode){
-        case 1:
-          val = land_exp->Cal(str, val_st, val_ma);
-          break;
-        case 2:
-          valx = lor_exp->Cal(str, val_st, val_ma);
-          valy = land_exp->Cal(str, val_st, val_ma);
-          val = valx || valy;
-          break;
-        default:
-          assert(false);
-          break;
+    case ast_kind_t::FuncDef: {
+      auto ast = static_cast<const FuncDefAST *>(node);
+      visit(ast->func_fparam_arr);
+      visit(ast->block);
+      break;
+    }
+    case ast_kind_t::FuncFParamArr: {
+      auto ast = static_cast<const FuncFParamArrAST *>(node);
+      for (auto &item : ast->func_fparams) visit(item);
+      break;
+    }
+    case ast_kind_t::FuncFParam: {
+      break;
+    }
+    case ast_kind_t::Block: {
+      auto ast = static_cast<const BlockAST *>(node);
+      visit(ast->block_item_arr);
+      break;
+    }
+    case ast_kind_t::BlockItemArr: {
+      auto ast = static_cast<const BlockItemArrAST *>(node);
+      for (auto &item : ast->items) visit(item.second);
+      break;
+    }
+    case ast_kind_t::Stmt: {
+      auto ast = static_cast<const StmtAST *>(node);
+      visit(ast->exp);
+      visit(ast->block);
+      visit(ast->stmt);
+      visit(ast->else_stmt);
+      break;
+    }
+    case ast_kind_t::Exp: {
+      // 表达式内部的节点在 exp_pool_t 中, 用 For_each_ref 访问
+      break;
+    }
+    case ast_kind_t::LVal: {
+      auto ast = static_cast<const LValAST *>(node);
+      visit(ast->exp_muti);
+      break;
+    }
+    case ast_kind_t::ExpMuti: {
+      auto ast = static_cast<const ExpMutiAST *>(node);
+      visit(ast->exp_muti);
+      visit(ast->exp);
+      break;
+    }
+    case ast_kind_t::ConstExp: {
+      auto ast = static_cast<const ConstExpAST *>(node);
+      visit(ast->exp);
+      break;
+    }
+  }
+}
+
+// 按源程序顺序访问表达式中的变量和函数调用 (包括实参里的), f 的参数为节点下标
+template <typename F>
+void For_each_ref(const exp_pool_t &pool, uint32_t root, F &&f){
+  std::vector<uint32_t> work = {root};
+  while (!work.empty()){
+    uint32_t node = work.back();
+    work.pop_back();
+    switch (pool.op[node]){
+      case exp_op_t::NUMBER:
+        break;
+      case exp_op_t::LVAL:
+        f(node);
+        break;
+      case exp_op_t::CALL: {
+        f(node);
+        auto &args = pool.calls[pool.lhs[node]].args;
+        for (auto it = args.rbegin(); it != args.rend(); ++it) work.push_back(*it);
+        break;
       }
-      return val;
+      case exp_op_t::NEG:
+      case exp_op_t::NOT:
+        work.push_back(pool.lhs[node]);
+        break;
+      default:
+        work.push_back(pool.rhs[node]);
+        work.push_back(pool.lhs[node]);
+        break;
     }
-
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      num_t tmpnum1, tmpnum2;
-      int value1, value2;
-      char stmp[20];
-      switch (mode){
-        case 1:
-          land_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          break;
-        case 2:
-          lor_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          land_exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
-          tmpnum1 = (*val_st).top();
-          value1 = tmpnum1.num_val;
-          (*val_st).pop();
-          tmpnum2 = (*val_st).top();
-          value2 = tmpnum2.num_val;
-          (*val_st).pop();
-          if (tmpnum1.valid == 1){
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = eq %d, 0\n", cnt+1, value2);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, cnt);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %d, 0\n", cnt+1, value1);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, cnt);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = or %%%d, %%%d\n", cnt+1, cnt, cnt-2);
-            }
-            else{
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, value2);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, cnt);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %d, 0\n", cnt+1, value1);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, cnt);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = or %%%d, %%%d\n", cnt+1, cnt, cnt-2);
-            }
-          }
-          else{
-            if (tmpnum2.valid == 1){
-              sprintf(stmp, "  %%%d = eq %d, 0\n", cnt+1, value2);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, cnt);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, value1);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, cnt);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = or %%%d, %%%d\n", cnt+1, cnt, cnt-2);
-            }
-            else{
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, value2);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, cnt);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, value1);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = eq %%%d, 0\n", cnt+1, cnt);
-              strcat(str, stmp);
-              cnt++;
-              sprintf(stmp, "  %%%d = or %%%d, %%%d\n", cnt+1, cnt, cnt-2);
-            }
-          }
-          strcat(str, stmp);
-          cnt++;
-          tmpnum1.num_val = cnt;
-          tmpnum1.valid = 0;
-          (*val_st).push(tmpnum1);
-          break;
-        default:
-          assert(false);
-          break;
+  }
+}
+
+// 一元运算和二元运算的常量折叠, 一元运算的 y 不用
+inline int Fold_exp(exp_op_t op, int x, int y){
+  switch (op){
+    case exp_op_t::NEG: return -x;
+    case exp_op_t::NOT: return !x;
+    case exp_op_t::MUL: return x * y;
+    case exp_op_t::DIV: return x / y;
+    case exp_op_t::MOD: return x % y;
+    case exp_op_t::ADD: return x + y;
+    case exp_op_t::SUB: return x - y;
+    case exp_op_t::LT: return x < y;
+    case exp_op_t::GT: return x > y;
+    case exp_op_t::LE: return x <= y;
+    case exp_op_t::GE: return x >= y;
+    case exp_op_t::EQ: return x == y;
+    case exp_op_t::NE: return x != y;
+    case exp_op_t::AND: return x && y;
+    case exp_op_t::OR: return x || y;
+    default:
+      assert(false);
+      return 0;
+  }
+}
+
+// 二元运算在 Koopa IR 中的指令名
+inline const char *Binary_name(exp_op_t op){
+  switch (op){
+    case exp_op_t::MUL: return "mul";
+    case exp_op_t::DIV: return "div";
+    case exp_op_t::MOD: return "mod";
+    case exp_op_t::ADD: return "add";
+    case exp_op_t::SUB: return "sub";
+    case exp_op_t::LT: return "lt";
+    case exp_op_t::GT: return "gt";
+    case exp_op_t::LE: return "le";
+    case exp_op_t::GE: return "ge";
+    case exp_op_t::EQ: return "eq";
+    case exp_op_t::NE: return "ne";
+    default:
+      assert(false);
+      return "";
+  }
+}
+
+// 函数调用, 实参已经求值压栈, 栈顶是第一个实参
+// 有返回值时结果存入新的临时变量, 压栈
+inline void Emit_call(dump_ctx_t &ctx, const call_t &call){
+  int type = call.sym != nullptr ? call.sym->type : 0;
+  if (type == 2){
+    ctx.str += "  %" + std::to_string(ctx.cnt + 1) + " = call @" + call.ident + "(";
+    ctx.cnt++;
+  }
+  else if (type == 3){
+    ctx.str += "  call @" + call.ident + "(";
+  }
+  for (size_t i = 0; i < call.args.size(); ++i){
+    num_t tmpnum = ctx.val_st.top();
+    ctx.val_st.pop();
+    if (type != 2 && type != 3) continue;
+    if (i > 0) ctx.str += ", ";
+    ctx.str += Operand(tmpnum);
+  }
+  if (type != 2 && type != 3) return;
+  ctx.str += ")\n";
+  if (type == 2){
+    num_t tmpnum;
+    tmpnum.num_val = ctx.cnt;
+    tmpnum.valid = 0;
+    ctx.val_st.push(tmpnum);
+  }
+}
+
+// 后序遍历: 第一次遇到节点时把子节点压栈 (左操作数在栈顶), 子节点都处理完后再生成节点自己的指令
+// 函数调用的实参也放进同一个栈, 嵌套调用 f(f(f(...))) 不会递归
+inline void Dump_exp(const exp_pool_t &pool, uint32_t root, dump_ctx_t &ctx, int global){
+  struct frame_t {
+    uint32_t node;
+    bool expanded;
+  };
+  std::vector<frame_t> work;
+  work.push_back({root, false});
+  while (!work.empty()){
+    uint32_t node = work.back().node;
+    exp_op_t op = pool.op[node];
+    if (!work.back().expanded && op != exp_op_t::NUMBER && op != exp_op_t::LVAL){
+      work.back().expanded = true;
+      if (op == exp_op_t::CALL){
+        // 实参从后往前求值, 按顺序压栈后最后一个实参在栈顶
+        for (uint32_t arg : pool.calls[pool.lhs[node]].args) work.push_back({arg, false});
       }
+      else if (op == exp_op_t::NEG || op == exp_op_t::NOT){
+        work.push_back({pool.lhs[node], false});
+      }
+      else{
+        work.push_back({pool.rhs[node], false});
+        work.push_back({pool.lhs[node], false});
+      }
+      continue;
     }
-};
-
-// ConstExp ::= Exp;
-class ConstExpAST : public BaseAST {
-  public:
-    std::unique_ptr<BaseAST> exp;
-
-    int Cal(char *str, std::stack<num_t>* val_st, std::map<std::string, sym_t>* val_ma) override {
-      int val = exp->Cal(str, val_st, val_ma);
-      return val;
+    work.pop_back();
+    num_t tmpnum;
+    switch (op){
+      case exp_op_t::NUMBER:
+        tmpnum.num_val = (int)pool.lhs[node];
+        tmpnum.valid = 1;
+        ctx.val_st.push(tmpnum);
+        break;
+      case exp_op_t::LVAL:
+        pool.lvals[pool.lhs[node]]->Dump(ctx, global);
+        break;
+      case exp_op_t::CALL:
+        Emit_call(ctx, pool.calls[pool.lhs[node]]);
+        break;
+      case exp_op_t::NEG:
+        Emit_unary(ctx, "sub 0, ", "");
+        break;
+      case exp_op_t::NOT:
+        Emit_unary(ctx, "eq ", ", 0");
+        break;
+      case exp_op_t::AND:
+        Emit_logic(ctx, "and");
+        break;
+      case exp_op_t::OR:
+        Emit_logic(ctx, "or");
+        break;
+      default:
+        Emit_binary(ctx, Binary_name(op));
+        break;
     }
-
-    void Dump(char *str, int & cnt, std::stack<int>* loop_cur,
-              std::stack<num_t>* val_st, int global,
-              std::map<std::string, sym_t>* val_ma) const override {
-      exp->Dump(str, cnt, loop_cur, val_st, global, val_ma);
+  }
+}
+
+// 常量求值, 遍历顺序与 Dump_exp 相同, 中间结果存在 vals 中
+// 函数调用不展开, 值为 0
+inline int Cal_exp(const exp_pool_t &pool, uint32_t root, dump_ctx_t &ctx){
+  struct frame_t {
+    uint32_t node;
+    bool expanded;
+  };
+  std::vector<frame_t> work;
+  std::vector<int> vals;
+  work.push_back({root, false});
+  while (!work.empty()){
+    uint32_t node = work.back().node;
+    exp_op_t op = pool.op[node];
+    if (!work.back().expanded && op != exp_op_t::NUMBER && op != exp_op_t::LVAL && op != exp_op_t::CALL){
+      work.back().expanded = true;
+      if (op != exp_op_t::NEG && op != exp_op_t::NOT) work.push_back({pool.rhs[node], false});
+      work.push_back({pool.lhs[node], false});
+      continue;
     }
-};
+    work.pop_back();
+    switch (op){
+      case exp_op_t::NUMBER:
+        vals.push_back((int)pool.lhs[node]);
+        break;
+      case exp_op_t::LVAL:
+        vals.push_back(pool.lvals[pool.lhs[node]]->Cal(ctx));
+        break;
+      case exp_op_t::CALL:
+        vals.push_back(0);
+        break;
+      case exp_op_t::NEG:
+      case exp_op_t::NOT:
+        vals.back() = Fold_exp(op, vals.back(), 0);
+        break;
+      default: {
+        int valy = vals.back();
+        vals.pop_back();
+        vals.back() = Fold_exp(op, vals.back(), valy);
+        break;
+      }
+    }
+  }
+  assert(vals.size() == 1);
+  return vals.back();
+}
@@ -0,0 +1,243 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// 编译结果缓存
+// 设置环境变量 SYSY_CACHE_DIR 后启用, 相同输入和相同编译选项直接复用上一次的输出
+// SYSY_CACHE_SIZE 为缓存目录的总大小上限 (字节), 超出时按最近使用时间淘汰
+
+typedef unsigned long long hash_t;
+
+const hash_t FNV_OFFSET = 14695981039346656037ULL;
+const hash_t FNV_PRIME = 1099511628211ULL;
+const long long DEFAULT_CACHE_SIZE = 64LL << 20;
+// 临时文件超过这么多秒还没有改名, 认为写它的编译器已经崩溃
+const time_t STALE_TMP_SECONDS = 600;
+
+// FNV-1a
+hash_t Hash_bytes(const void *data, size_t len, hash_t h = FNV_OFFSET){
+  const unsigned char *p = (const unsigned char *)data;
+  for (size_t i = 0; i < len; ++i){
+    h ^= p[i];
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+extern const char *core_name();
+
+// 缓存目录, 未设置时返回 nullptr
+static const char *Cache_dir(){
+  const char *dir = getenv("SYSY_CACHE_DIR");
+  if (dir == nullptr || dir[0] == '\0') return nullptr;
+  return dir;
+}
+
+bool cache_enabled(){
+  return Cache_dir() != nullptr;
+}
+
+static std::string Cache_path(const char *dir, hash_t key){
+  char name[32];
+  sprintf(name, "/%016llx", key);
+  return std::string(dir) + name;
+}
+
+// 编译器本身的标识: 可执行文件的设备号, inode, 大小和修改时间
+// 重新构建编译器后标识随之改变, 旧编译器留下的缓存不会再被命中
+hash_t build_id(){
+  static const hash_t id = [](){
+    struct stat st;
+    hash_t h = FNV_OFFSET;
+    if (stat("/proc/self/exe", &st) == 0){
+      long long fields[] = {(long long)st.st_dev, (long long)st.st_ino, (long long)st.st_size,
+                            (long long)st.st_mtim.tv_sec, (long long)st.st_mtim.tv_nsec};
+      h = Hash_bytes(fields, sizeof(fields), h);
+    }
+    return h;
+  }();
+  return id;
+}
+
+// 计算缓存键: 编译器标识 + 目标核 + 输入文件内容 + 除输入输出路径以外的所有参数
+// 所有会改变输出的设置 (命令行参数, 环境变量 SYSY_CORE 等) 都必须计入缓存键, 否则会命中错误的结果
+// 返回 0 表示不使用缓存
+hash_t cache_key(const char *input, int argc, const char *argv[]){
+  if (Cache_dir() == nullptr) return 0;
+  int fd = open(input, O_RDONLY);
+  if (fd < 0) return 0;
+  struct stat st;
+  if (fstat(fd, &st) < 0){
+    close(fd);
+    return 0;
+  }
+  hash_t h = build_id();
+  if (st.st_size > 0){
+    void *buf = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (buf == MAP_FAILED){
+      close(fd);
+      return 0;
+    }
+    h = Hash_bytes(buf, st.st_size, h);
+    munmap(buf, st.st_size);
+  }
+  close(fd);
+  h = Hash_bytes(core_name(), strlen(core_name()) + 1, h);
+  for (int i = 1; i < argc; ++i){
+    if (i == 2 || i == 4) continue;
+    h = Hash_bytes(argv[i], strlen(argv[i]) + 1, h);
+  }
+  return h ? h : 1;
+}
+
+// 查找缓存, 命中时把缓存内容直接写到输出文件
+bool cache_fetch(hash_t key, const char *output){
+  const char *dir = Cache_dir();
+  if (dir == nullptr || key == 0) return false;
+  std::string path = Cache_path(dir, key);
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) < 0){
+    close(fd);
+    return false;
+  }
+
+  void *buf = nullptr;
+  if (st.st_size > 0){
+    buf = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (buf == MAP_FAILED){
+      close(fd);
+      return false;
+    }
+  }
+  close(fd);
+
+  bool ok = false;
+  int out = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (out >= 0){
+    const char *p = (const char *)buf;
+    ssize_t left = st.st_size, n = 0;
+    while (left > 0 && (n = write(out, p, left)) > 0){
+      p += n;
+      left -= n;
+    }
+    ok = left == 0;
+    close(out);
+  }
+  if (buf != nullptr) munmap(buf, st.st_size);
+
+  // 更新修改时间, 作为 LRU 淘汰的依据
+  if (ok) utime(path.c_str(), nullptr);
+  return ok;
+}
+
+// 按最近使用时间淘汰, 直到缓存总大小不超过上限
+// 其他进程正在写的临时文件 (<key>.tmp<pid>_<n>) 不计入总大小也不淘汰, 否则它们的 rename 会失败;
+// 崩溃的编译器留下的临时文件过了 STALE_TMP_SECONDS 才删掉
+static void Cache_evict(const char *dir){
+  long long budget = DEFAULT_CACHE_SIZE;
+  const char *size = getenv("SYSY_CACHE_SIZE");
+  if (size != nullptr && size[0] != '\0') budget = atoll(size);
+
+  struct entry_t{
+    std::string path;
+    long long size;
+    struct timespec mtime;
+  };
+  std::vector<entry_t> entries;
+  long long total = 0;
+  time_t now = time(nullptr);
+  DIR *d = opendir(dir);
+  if (d == nullptr) return;
+  while (struct dirent *e = readdir(d)){
+    if (e->d_name[0] == '.') continue;
+    std::string path = std::string(dir) + "/" + e->d_name;
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) continue;
+    if (strstr(e->d_name, ".tmp") != nullptr){
+      if (now - st.st_mtime > STALE_TMP_SECONDS) unlink(path.c_str());
+      continue;
+    }
+    entries.push_back({path, (long long)st.st_size, st.st_mtim});
+    total += st.st_size;
+  }
+  closedir(d);
+
+  // 按纳秒精度的修改时间排序, 同一秒内连续编译的先后顺序也能保持
+  std::sort(entries.begin(), entries.end(), [](const entry_t &a, const entry_t &b){
+    if (a.mtime.tv_sec != b.mtime.tv_sec) return a.mtime.tv_sec < b.mtime.tv_sec;
+    return a.mtime.tv_nsec < b.mtime.tv_nsec;
+  });
+  for (size_t i = 0; i < entries.size() && total > budget; ++i){
+    if (unlink(entries[i].path.c_str()) == 0) total -= entries[i].size;
+  }
+}
+
+// 把一段数据写入缓存
+// 先写临时文件再改名, 避免并发编译 (或同一进程的其他线程) 读到写了一半的缓存
+static bool Cache_write(hash_t key, const char *data, size_t len){
+  static std::atomic<int> seq(0);
+  const char *dir = Cache_dir();
+  if (dir == nullptr || key == 0) return false;
+  mkdir(dir, 0755);
+
+  std::string path = Cache_path(dir, key);
+  std::string tmp = path + ".tmp" + std::to_string(getpid()) + "_" + std::to_string(seq++);
+  FILE *out = fopen(tmp.c_str(), "wb");
+  if (out == nullptr) return false;
+  bool ok = fwrite(data, 1, len, out) == len;
+  if (fclose(out) != 0) ok = false;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0){
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+// 把本次的输出文件存入缓存
+void cache_store(hash_t key, const char *output){
+  const char *dir = Cache_dir();
+  if (dir == nullptr || key == 0) return;
+  FILE *in = fopen(output, "rb");
+  if (in == nullptr) return;
+  std::string data;
+  char buf[1 << 16];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0) data.append(buf, n);
+  fclose(in);
+  if (Cache_write(key, data.data(), data.size())) Cache_evict(dir);
+}
+
+// 单个函数的缓存, 由后端按函数的 Koopa IR 文本查找和保存生成的汇编
+// 淘汰统一在整个程序编译结束时由 cache_store 完成
+bool cache_load(hash_t key, std::string &data){
+  const char *dir = Cache_dir();
+  if (dir == nullptr || key == 0) return false;
+  std::string path = Cache_path(dir, key);
+  FILE *in = fopen(path.c_str(), "rb");
+  if (in == nullptr) return false;
+  data.clear();
+  char buf[1 << 16];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0) data.append(buf, n);
+  bool ok = !ferror(in);
+  fclose(in);
+  if (ok) utime(path.c_str(), nullptr);
+  return ok;
+}
+
+void cache_save(hash_t key, const std::string &data){
+  Cache_write(key, data.data(), data.size());
+}
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <vector>
+#include "effect.hpp"
+#include "alias.hpp"
+
+// 函数的副作用分析
+// 先看每个函数自己的指令: 读写全局变量 (或者经过指针读写) 分别是 READ 和 WRITE, 只访问自己的局部数组不算,
+// 调用只有声明的函数 (运行时库) 是 IO; 再沿调用图把被调用者的副作用传给调用者, 直到不再变化.
+// 递归的函数从 PURE 开始迭代, 只会往上升, 所以一定收敛
+
+extern unsigned long long Hash_bytes(const void *data, size_t len, unsigned long long h);
+
+static std::map<koopa_raw_function_t, effect_t> effects;
+static unsigned long long hash;
+
+// 函数自己的指令带来的副作用, 顺便记下它调用的函数
+static effect_t Own_effect(koopa_raw_function_t func, std::vector<koopa_raw_function_t> &callees){
+  effect_t effect = effect_t::PURE;
+  for (size_t i = 0; i < func->bbs.len; ++i){
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    for (size_t j = 0; j < bb->insts.len; ++j){
+      auto value = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+      const auto &kind = value->kind;
+      switch (kind.tag){
+        case KOOPA_RVT_LOAD:
+          if (!points_to_local(kind.data.load.src)) effect = std::max(effect, effect_t::READ);
+          break;
+        case KOOPA_RVT_STORE:
+          if (!points_to_local(kind.data.store.dest)) effect = std::max(effect, effect_t::WRITE);
+          break;
+        case KOOPA_RVT_CALL:
+          callees.push_back(kind.data.call.callee);
+          break;
+        default:
+          break;
+      }
+    }
+  }
+  return effect;
+}
+
+void analyze_effects(const koopa_raw_program_t &program){
+  effects.clear();
+  const auto &funcs = program.funcs;
+  std::vector<effect_t> own(funcs.len);
+  std::vector<std::vector<koopa_raw_function_t>> callees(funcs.len);
+  for (size_t i = 0; i < funcs.len; ++i){
+    auto func = reinterpret_cast<koopa_raw_function_t>(funcs.buffer[i]);
+    // 只有声明的函数是运行时库
+    own[i] = func->bbs.len == 0 ? effect_t::IO : Own_effect(func, callees[i]);
+    effects[func] = own[i];
+  }
+
+  bool changed = true;
+  while (changed){
+    changed = false;
+    for (size_t i = 0; i < funcs.len; ++i){
+      auto func = reinterpret_cast<koopa_raw_function_t>(funcs.buffer[i]);
+      effect_t effect = own[i];
+      for (auto callee : callees[i]) effect = std::max(effect, effect_of(callee));
+      if (effect != effects[func]){
+        effects[func] = effect;
+        changed = true;
+      }
+    }
+  }
+
+  hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < funcs.len; ++i){
+    auto func = reinterpret_cast<koopa_raw_function_t>(funcs.buffer[i]);
+    char effect = (char)effects[func];
+    hash = Hash_bytes(func->name, strlen(func->name), hash);
+    hash = Hash_bytes(&effect, 1, hash);
+  }
+}
+
+// 不在程序里的函数按最坏情况处理
+effect_t effect_of(koopa_raw_function_t func){
+  auto it = effects.find(func);
+  return it == effects.end() ? effect_t::IO : it->second;
+}
+
+unsigned long long effects_hash(){
+  return hash;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "koopa.h"
+
+// 函数的副作用, 从小到大排列; 函数的副作用不小于它调用的所有函数
+enum class effect_t {
+  // 结果只取决于参数, 可以合并和外提
+  PURE,
+  // 还读全局变量, 两次调用之间没有写全局变量时结果相同
+  READ,
+  // 写全局变量
+  WRITE,
+  // 调用运行时库 (getint, putint 等), 有输入输出
+  IO,
+};
+
+// 在调用图上求出所有函数的副作用, 生成代码之前调用一次, 之后只读
+void analyze_effects(const koopa_raw_program_t &program);
+effect_t effect_of(koopa_raw_function_t func);
+// 所有函数副作用的散列, 计入函数级缓存的键
+unsigned long long effects_hash();
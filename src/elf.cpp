@@ -0,0 +1,702 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include "writer.hpp"
+
+// RISC-V 目标文件输出
+// -obj 模式下, 后端生成的汇编在进程内直接编码成 RV32IM (打开 -rvv 时还有 V 扩展) 机器码, 写成 ELF32 可重定位目标文件,
+// 链接时不再需要先调用汇编器
+// 只支持后端会生成的指令, 伪指令和汇编指示符
+
+enum { SEC_TEXT = 1, SEC_DATA = 2, SEC_BSS = 3 };
+
+// ELF 中 RISC-V 的重定位类型
+enum {
+  R_RISCV_BRANCH = 16,
+  R_RISCV_JAL = 17,
+  R_RISCV_CALL = 18,
+  R_RISCV_PCREL_HI20 = 23,
+  R_RISCV_PCREL_LO12_I = 24,
+  R_RISCV_HI20 = 26,
+  R_RISCV_LO12_I = 27,
+  R_RISCV_LO12_S = 28,
+};
+
+struct asm_sym_t{
+  std::string name;
+  // 0 表示未定义
+  int sec = 0;
+  uint32_t value = 0;
+  bool global = false;
+  bool used = false;
+};
+
+struct asm_reloc_t{
+  uint32_t offset;
+  int sym, type;
+  int32_t addend;
+};
+
+struct assembler_t{
+  std::vector<uint8_t> text, data;
+  uint32_t bss_size = 0;
+  int sec = SEC_TEXT;
+  std::vector<asm_sym_t> syms;
+  std::map<std::string, int> sym_index;
+  std::vector<asm_reloc_t> relocs;
+  // 跳转到本文件 .text 中的标号时, 等所有标号都确定后直接回填偏移, 不生成重定位
+  std::vector<asm_reloc_t> fixups;
+  int pcrel_cnt = 0;
+  int line = 0;
+  bool ok = true;
+};
+
+static void Error(assembler_t &as, const char *msg, const std::string &what){
+  fprintf(stderr, "asm error at line %d: %s '%s'\n", as.line, msg, what.c_str());
+  as.ok = false;
+}
+
+static int Symbol(assembler_t &as, const std::string &name){
+  auto it = as.sym_index.find(name);
+  if (it != as.sym_index.end()) return it->second;
+  asm_sym_t sym;
+  sym.name = name;
+  as.syms.push_back(sym);
+  as.sym_index[name] = as.syms.size() - 1;
+  return as.syms.size() - 1;
+}
+
+static uint32_t Offset(assembler_t &as){
+  if (as.sec == SEC_TEXT) return as.text.size();
+  if (as.sec == SEC_DATA) return as.data.size();
+  return as.bss_size;
+}
+
+static void Put32(std::vector<uint8_t> &buf, uint32_t val){
+  for (int i = 0; i < 4; ++i) buf.push_back(val >> (i * 8));
+}
+
+static void Set32(std::vector<uint8_t> &buf, uint32_t pos, uint32_t val){
+  for (int i = 0; i < 4; ++i) buf[pos + i] = val >> (i * 8);
+}
+
+static uint32_t Get32(const std::vector<uint8_t> &buf, uint32_t pos){
+  return buf[pos] | buf[pos + 1] << 8 | buf[pos + 2] << 16 | (uint32_t)buf[pos + 3] << 24;
+}
+
+// 指令编码
+static uint32_t R_type(int f7, int rs2, int rs1, int f3, int rd, int op){
+  return f7 << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | rd << 7 | op;
+}
+
+static uint32_t I_type(int32_t imm, int rs1, int f3, int rd, int op){
+  return (uint32_t)(imm & 0xfff) << 20 | rs1 << 15 | f3 << 12 | rd << 7 | op;
+}
+
+static uint32_t S_type(int32_t imm, int rs2, int rs1, int f3){
+  return (uint32_t)(imm >> 5 & 0x7f) << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 |
+         (imm & 0x1f) << 7 | 0x23;
+}
+
+static uint32_t B_imm(int32_t imm){
+  return (uint32_t)(imm >> 12 & 1) << 31 | (imm >> 5 & 0x3f) << 25 |
+         (imm >> 1 & 0xf) << 8 | (imm >> 11 & 1) << 7;
+}
+
+static uint32_t J_imm(int32_t imm){
+  return (uint32_t)(imm >> 20 & 1) << 31 | (imm >> 1 & 0x3ff) << 21 |
+         (imm >> 11 & 1) << 20 | (imm >> 12 & 0xff) << 12;
+}
+
+static uint32_t U_type(uint32_t imm, int rd, int op){
+  return (imm & 0xfffff) << 12 | rd << 7 | op;
+}
+
+static void Inst(assembler_t &as, uint32_t code){
+  Put32(as.text, code);
+}
+
+static void Reloc(assembler_t &as, int sym, int type){
+  as.syms[sym].used = true;
+  as.relocs.push_back({(uint32_t)as.text.size(), sym, type, 0});
+}
+
+// 操作数解析
+static int Reg(assembler_t &as, const std::string &name){
+  static const char *abi[32] = {
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+  };
+  for (int i = 0; i < 32; ++i){
+    if (name == abi[i]) return i;
+  }
+  if (name == "fp") return 8;
+  if (name.size() >= 2 && name[0] == 'x'){
+    char *end;
+    long r = strtol(name.c_str() + 1, &end, 10);
+    if (*end == '\0' && r >= 0 && r < 32) return r;
+  }
+  Error(as, "unknown register", name);
+  return 0;
+}
+
+static int Vreg(assembler_t &as, const std::string &name){
+  if (name.size() >= 2 && name[0] == 'v'){
+    char *end;
+    long r = strtol(name.c_str() + 1, &end, 10);
+    if (*end == '\0' && r >= 0 && r < 32) return r;
+  }
+  Error(as, "unknown vector register", name);
+  return 0;
+}
+
+static int32_t Number(assembler_t &as, const std::string &s){
+  char *end;
+  long long val = strtoll(s.c_str(), &end, 0);
+  if (s.empty() || *end != '\0') Error(as, "bad immediate", s);
+  return (int32_t)val;
+}
+
+// 立即数, 可以是 %hi(sym) / %lo(sym), 此时 sym 返回符号下标, reloc 返回重定位种类
+static int32_t Imm(assembler_t &as, const std::string &s, int &sym, int &reloc){
+  sym = -1;
+  reloc = 0;
+  if (s.size() > 5 && s[0] == '%' && s.back() == ')'){
+    if (s.compare(0, 4, "%hi(") == 0) reloc = R_RISCV_HI20;
+    else if (s.compare(0, 4, "%lo(") == 0) reloc = R_RISCV_LO12_I;
+    else Error(as, "unknown modifier", s);
+    sym = Symbol(as, s.substr(4, s.size() - 5));
+    return 0;
+  }
+  return Number(as, s);
+}
+
+// imm(reg) 形式的访存地址
+static void Mem(assembler_t &as, const std::string &s, int32_t &imm, int &rs1, int &sym, int &reloc){
+  size_t pos = s.rfind('(');
+  if (pos == std::string::npos || s.back() != ')'){
+    Error(as, "bad memory operand", s);
+    imm = rs1 = 0;
+    sym = -1;
+    reloc = 0;
+    return;
+  }
+  imm = 0;
+  sym = -1;
+  reloc = 0;
+  if (pos > 0) imm = Imm(as, s.substr(0, pos), sym, reloc);
+  rs1 = Reg(as, s.substr(pos + 1, s.size() - pos - 2));
+}
+
+static void Label(assembler_t &as, const std::string &name){
+  int id = Symbol(as, name);
+  if (as.syms[id].sec != 0) Error(as, "duplicate label", name);
+  as.syms[id].sec = as.sec;
+  as.syms[id].value = Offset(as);
+}
+
+// 跳转和分支: 目标先记下来, 最后回填或生成重定位
+static void Jump_to(assembler_t &as, uint32_t code, const std::string &target, int type){
+  int sym = Symbol(as, target);
+  as.fixups.push_back({(uint32_t)as.text.size(), sym, type, 0});
+  Inst(as, code);
+}
+
+static void Li(assembler_t &as, int rd, int32_t imm){
+  if (imm >= -2048 && imm < 2048){
+    Inst(as, I_type(imm, 0, 0, rd, 0x13));
+    return;
+  }
+  int32_t lo = (int32_t)((uint32_t)imm << 20) >> 20;
+  uint32_t hi = ((uint32_t)imm - lo) >> 12;
+  Inst(as, U_type(hi, rd, 0x37));
+  if (lo != 0) Inst(as, I_type(lo, rd, 0, rd, 0x13));
+}
+
+// auipc + 第二条指令, 第二条指令的重定位指向 auipc 处的局部标号
+static void Pcrel(assembler_t &as, int rd, const std::string &target, uint32_t second, int type){
+  char name[32];
+  sprintf(name, ".Lpcrel_hi%d", as.pcrel_cnt++);
+  Label(as, name);
+  int hi = Symbol(as, name);
+  Reloc(as, Symbol(as, target), R_RISCV_PCREL_HI20);
+  Inst(as, U_type(0, rd, 0x17));
+  Reloc(as, hi, type);
+  Inst(as, second);
+}
+
+struct r_op_t{ const char *name; int f7, f3; };
+static const r_op_t r_ops[] = {
+  {"add", 0, 0}, {"sub", 0x20, 0}, {"sll", 0, 1}, {"slt", 0, 2}, {"sltu", 0, 3},
+  {"xor", 0, 4}, {"srl", 0, 5}, {"sra", 0x20, 5}, {"or", 0, 6}, {"and", 0, 7},
+  {"mul", 1, 0}, {"mulh", 1, 1}, {"mulhsu", 1, 2}, {"mulhu", 1, 3},
+  {"div", 1, 4}, {"divu", 1, 5}, {"rem", 1, 6}, {"remu", 1, 7},
+};
+
+struct i_op_t{ const char *name; int f3; };
+static const i_op_t i_ops[] = {
+  {"addi", 0}, {"slti", 2}, {"sltiu", 3}, {"xori", 4}, {"ori", 6}, {"andi", 7},
+};
+static const i_op_t load_ops[] = {
+  {"lb", 0}, {"lh", 1}, {"lw", 2}, {"lbu", 4}, {"lhu", 5},
+};
+static const i_op_t store_ops[] = {
+  {"sb", 0}, {"sh", 1}, {"sw", 2},
+};
+static const i_op_t branch_ops[] = {
+  {"beq", 0}, {"bne", 1}, {"blt", 4}, {"bge", 5}, {"bltu", 6}, {"bgeu", 7},
+};
+
+// 向量运算 (不带掩码): 名字, funct6, funct3 (0 为 OPIVV, 2 为 OPMVV, 4 为 OPIVX, 6 为 OPMVX)
+// 操作数都是 vd, vs2, vs1/rs1, 编码的 rs1 位置放 vs1 或 rs1
+struct v_op_t{ const char *name; int f6, f3; };
+static const v_op_t v_ops[] = {
+  {"vadd.vv", 0x00, 0}, {"vsub.vv", 0x02, 0}, {"vadd.vx", 0x00, 4}, {"vsub.vx", 0x02, 4}, {"vrsub.vx", 0x03, 4},
+  {"vmul.vv", 0x25, 2}, {"vdiv.vv", 0x21, 2}, {"vrem.vv", 0x23, 2}, {"vredsum.vs", 0x00, 2},
+  {"vmul.vx", 0x25, 6},
+};
+
+static uint32_t V_type(int f6, int vs2, int rs1, int f3, int vd){
+  return (uint32_t)f6 << 26 | 1u << 25 | vs2 << 20 | rs1 << 15 | f3 << 12 | vd << 7 | 0x57;
+}
+
+// vsetvli 的 vtype: e8/e16/e32, m1/m2/m4/m8, ta/tu, ma/mu
+static int32_t Vtype(assembler_t &as, const std::vector<std::string> &args){
+  int32_t vtype = 0;
+  for (size_t i = 2; i < args.size(); ++i){
+    auto &a = args[i];
+    if (a == "e8" || a == "e16" || a == "e32") vtype |= (a == "e8" ? 0 : a == "e16" ? 1 : 2) << 3;
+    else if (a == "m1" || a == "m2" || a == "m4" || a == "m8") vtype |= a == "m1" ? 0 : a == "m2" ? 1 : a == "m4" ? 2 : 3;
+    else if (a == "ta") vtype |= 1 << 6;
+    else if (a == "ma") vtype |= 1 << 7;
+    else if (a != "tu" && a != "mu") Error(as, "bad vtype", a);
+  }
+  return vtype;
+}
+
+// 伪分支: 名字, 对应的分支, 是否交换两个操作数, 是否与 zero 比较 (1 为 rs, zero; 2 为 zero, rs)
+struct pseudo_branch_t{ const char *name; const char *op; bool swap; int zero; };
+static const pseudo_branch_t pseudo_branches[] = {
+  {"beqz", "beq", false, 1}, {"bnez", "bne", false, 1},
+  {"bltz", "blt", false, 1}, {"bgez", "bge", false, 1},
+  {"blez", "bge", false, 2}, {"bgtz", "blt", false, 2},
+  {"bgt", "blt", true, 0}, {"ble", "bge", true, 0},
+  {"bgtu", "bltu", true, 0}, {"bleu", "bgeu", true, 0},
+};
+
+static void Instruction(assembler_t &as, const std::string &op, const std::vector<std::string> &args){
+  auto need = [&](size_t n){
+    if (args.size() == n) return true;
+    Error(as, "wrong number of operands for", op);
+    return false;
+  };
+  int sym, reloc;
+  int32_t imm;
+  int rs1;
+
+  for (auto &r : r_ops){
+    if (op != r.name) continue;
+    if (need(3)) Inst(as, R_type(r.f7, Reg(as, args[2]), Reg(as, args[1]), r.f3, Reg(as, args[0]), 0x33));
+    return;
+  }
+  for (auto &i : i_ops){
+    if (op != i.name) continue;
+    if (!need(3)) return;
+    imm = Imm(as, args[2], sym, reloc);
+    if (sym >= 0) Reloc(as, sym, R_RISCV_LO12_I);
+    Inst(as, I_type(imm, Reg(as, args[1]), i.f3, Reg(as, args[0]), 0x13));
+    return;
+  }
+  for (auto &l : load_ops){
+    if (op != l.name) continue;
+    if (!need(2)) return;
+    Mem(as, args[1], imm, rs1, sym, reloc);
+    if (sym >= 0) Reloc(as, sym, R_RISCV_LO12_I);
+    Inst(as, I_type(imm, rs1, l.f3, Reg(as, args[0]), 0x03));
+    return;
+  }
+  for (auto &s : store_ops){
+    if (op != s.name) continue;
+    if (!need(2)) return;
+    Mem(as, args[1], imm, rs1, sym, reloc);
+    if (sym >= 0) Reloc(as, sym, R_RISCV_LO12_S);
+    Inst(as, S_type(imm, Reg(as, args[0]), rs1, s.f3));
+    return;
+  }
+  for (auto &b : branch_ops){
+    if (op != b.name) continue;
+    if (need(3)) Jump_to(as, R_type(0, Reg(as, args[1]), Reg(as, args[0]), b.f3, 0, 0x63), args[2], R_RISCV_BRANCH);
+    return;
+  }
+  for (auto &v : v_ops){
+    if (op != v.name) continue;
+    if (!need(3)) return;
+    int src = v.f3 >= 4 ? Reg(as, args[2]) : Vreg(as, args[2]);
+    Inst(as, V_type(v.f6, Vreg(as, args[1]), src, v.f3, Vreg(as, args[0])));
+    return;
+  }
+  for (auto &p : pseudo_branches){
+    if (op != p.name) continue;
+    int f3 = 0;
+    for (auto &b : branch_ops){
+      if (strcmp(b.name, p.op) == 0) f3 = b.f3;
+    }
+    int rs1 = 0, rs2 = 0;
+    if (p.zero == 0){
+      if (!need(3)) return;
+      rs1 = Reg(as, args[0]);
+      rs2 = Reg(as, args[1]);
+      if (p.swap) std::swap(rs1, rs2);
+    }
+    else{
+      if (!need(2)) return;
+      (p.zero == 1 ? rs1 : rs2) = Reg(as, args[0]);
+    }
+    Jump_to(as, R_type(0, rs2, rs1, f3, 0, 0x63), args.back(), R_RISCV_BRANCH);
+    return;
+  }
+
+  if (op == "slli" || op == "srli" || op == "srai"){
+    if (!need(3)) return;
+    imm = Number(as, args[2]) & 0x1f;
+    if (op == "srai") imm |= 0x400;
+    Inst(as, I_type(imm, Reg(as, args[1]), op == "slli" ? 1 : 5, Reg(as, args[0]), 0x13));
+  }
+  else if (op == "lui" || op == "auipc"){
+    if (!need(2)) return;
+    imm = Imm(as, args[1], sym, reloc);
+    if (sym >= 0) Reloc(as, sym, R_RISCV_HI20);
+    Inst(as, U_type(imm, Reg(as, args[0]), op == "lui" ? 0x37 : 0x17));
+  }
+  else if (op == "li"){
+    if (need(2)) Li(as, Reg(as, args[0]), Number(as, args[1]));
+  }
+  else if (op == "mv"){
+    if (need(2)) Inst(as, I_type(0, Reg(as, args[1]), 0, Reg(as, args[0]), 0x13));
+  }
+  else if (op == "not"){
+    if (need(2)) Inst(as, I_type(-1, Reg(as, args[1]), 4, Reg(as, args[0]), 0x13));
+  }
+  else if (op == "neg"){
+    if (need(2)) Inst(as, R_type(0x20, Reg(as, args[1]), 0, 0, Reg(as, args[0]), 0x33));
+  }
+  else if (op == "seqz"){
+    if (need(2)) Inst(as, I_type(1, Reg(as, args[1]), 3, Reg(as, args[0]), 0x13));
+  }
+  else if (op == "snez"){
+    if (need(2)) Inst(as, R_type(0, Reg(as, args[1]), 0, 3, Reg(as, args[0]), 0x33));
+  }
+  else if (op == "sltz"){
+    if (need(2)) Inst(as, R_type(0, 0, Reg(as, args[1]), 2, Reg(as, args[0]), 0x33));
+  }
+  else if (op == "sgtz"){
+    if (need(2)) Inst(as, R_type(0, Reg(as, args[1]), 0, 2, Reg(as, args[0]), 0x33));
+  }
+  else if (op == "sgt" || op == "sgtu"){
+    if (need(3)) Inst(as, R_type(0, Reg(as, args[1]), Reg(as, args[2]), op == "sgt" ? 2 : 3, Reg(as, args[0]), 0x33));
+  }
+  else if (op == "nop"){
+    if (need(0)) Inst(as, I_type(0, 0, 0, 0, 0x13));
+  }
+  else if (op == "j"){
+    if (need(1)) Jump_to(as, 0x6f, args[0], R_RISCV_JAL);
+  }
+  else if (op == "jal"){
+    if (args.size() == 1) Jump_to(as, 1 << 7 | 0x6f, args[0], R_RISCV_JAL);
+    else if (need(2)) Jump_to(as, Reg(as, args[0]) << 7 | 0x6f, args[1], R_RISCV_JAL);
+  }
+  else if (op == "jr"){
+    if (need(1)) Inst(as, I_type(0, Reg(as, args[0]), 0, 0, 0x67));
+  }
+  else if (op == "jalr"){
+    if (args.size() == 1) Inst(as, I_type(0, Reg(as, args[0]), 0, 1, 0x67));
+    else if (need(2)){
+      Mem(as, args[1], imm, rs1, sym, reloc);
+      Inst(as, I_type(imm, rs1, 0, Reg(as, args[0]), 0x67));
+    }
+  }
+  else if (op == "ret"){
+    if (need(0)) Inst(as, I_type(0, 1, 0, 0, 0x67));
+  }
+  else if (op == "call" || op == "tail"){
+    if (!need(1)) return;
+    // auipc + jalr, 由一个 R_RISCV_CALL 重定位同时修正两条指令
+    int rd = op == "call" ? 1 : 6;
+    Reloc(as, Symbol(as, args[0]), R_RISCV_CALL);
+    Inst(as, U_type(0, rd, 0x17));
+    Inst(as, I_type(0, rd, 0, op == "call" ? 1 : 0, 0x67));
+  }
+  else if (op == "vsetvli"){
+    if (args.size() < 3){
+      Error(as, "wrong number of operands for", op);
+      return;
+    }
+    Inst(as, I_type(Vtype(as, args), Reg(as, args[1]), 7, Reg(as, args[0]), 0x57));
+  }
+  else if (op == "vid.v"){
+    if (need(1)) Inst(as, V_type(0x14, 0, 0x11, 2, Vreg(as, args[0])));
+  }
+  else if (op == "vmv.v.x"){
+    if (need(2)) Inst(as, V_type(0x17, 0, Reg(as, args[1]), 4, Vreg(as, args[0])));
+  }
+  else if (op == "vmv.s.x"){
+    if (need(2)) Inst(as, V_type(0x10, 0, Reg(as, args[1]), 6, Vreg(as, args[0])));
+  }
+  else if (op == "vmv.x.s"){
+    if (need(2)) Inst(as, V_type(0x10, Vreg(as, args[1]), 0, 2, Reg(as, args[0])));
+  }
+  else if (op == "la"){
+    if (!need(2)) return;
+    int rd = Reg(as, args[0]);
+    Pcrel(as, rd, args[1], I_type(0, rd, 0, rd, 0x13), R_RISCV_PCREL_LO12_I);
+  }
+  else{
+    Error(as, "unknown instruction", op);
+  }
+}
+
+static void Align(assembler_t &as, int p2){
+  uint32_t mask = (1u << p2) - 1;
+  while (Offset(as) & mask){
+    if (as.sec == SEC_TEXT){
+      Inst(as, I_type(0, 0, 0, 0, 0x13));
+    }
+    else if (as.sec == SEC_DATA){
+      as.data.push_back(0);
+    }
+    else{
+      as.bss_size++;
+    }
+  }
+}
+
+static void Directive(assembler_t &as, const std::string &op, const std::vector<std::string> &args){
+  if (op == ".text") as.sec = SEC_TEXT;
+  else if (op == ".data") as.sec = SEC_DATA;
+  else if (op == ".bss") as.sec = SEC_BSS;
+  else if (op == ".section" && !args.empty()){
+    if (args[0].compare(0, 5, ".text") == 0) as.sec = SEC_TEXT;
+    else if (args[0].compare(0, 5, ".data") == 0 || args[0].compare(0, 7, ".sdata") == 0) as.sec = SEC_DATA;
+    else if (args[0].compare(0, 4, ".bss") == 0 || args[0].compare(0, 5, ".sbss") == 0) as.sec = SEC_BSS;
+    else Error(as, "unknown section", args[0]);
+  }
+  else if (op == ".global" || op == ".globl"){
+    for (auto &name : args) as.syms[Symbol(as, name)].global = true;
+  }
+  else if (op == ".align" || op == ".p2align"){
+    if (!args.empty()) Align(as, Number(as, args[0]));
+  }
+  else if (op == ".word"){
+    for (auto &val : args){
+      if (as.sec == SEC_DATA) Put32(as.data, Number(as, val));
+      else if (as.sec == SEC_TEXT) Put32(as.text, Number(as, val));
+      else Error(as, ".word in", ".bss");
+    }
+  }
+  else if (op == ".zero" || op == ".space"){
+    int32_t n = args.empty() ? 0 : Number(as, args[0]);
+    if (as.sec == SEC_BSS) as.bss_size += n;
+    else if (as.sec == SEC_DATA) as.data.insert(as.data.end(), n, 0);
+    else as.text.insert(as.text.end(), n, 0);
+  }
+  else if (op == ".type" || op == ".size" || op == ".file" || op == ".option" || op == ".attribute"){
+    // 与目标文件内容无关
+  }
+  else{
+    Error(as, "unknown directive", op);
+  }
+}
+
+// 解析一行: [标号:] [指令 操作数, ...]
+static void Line(assembler_t &as, const char *p, const char *end){
+  const char *hash = (const char *)memchr(p, '#', end - p);
+  if (hash != nullptr) end = hash;
+  for (;;){
+    while (p < end && (*p == ' ' || *p == '\t')) ++p;
+    const char *q = p;
+    while (q < end && *q != ':' && *q != ' ' && *q != '\t' && *q != ',') ++q;
+    if (q < end && *q == ':' && q > p){
+      Label(as, std::string(p, q));
+      p = q + 1;
+      continue;
+    }
+    break;
+  }
+  while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) --end;
+  if (p == end) return;
+
+  const char *q = p;
+  while (q < end && *q != ' ' && *q != '\t') ++q;
+  std::string op(p, q);
+  std::vector<std::string> args;
+  p = q;
+  while (p < end){
+    while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) ++p;
+    q = p;
+    int depth = 0;
+    while (q < end && (depth > 0 || *q != ',')){
+      if (*q == '(') depth++;
+      else if (*q == ')') depth--;
+      ++q;
+    }
+    const char *e = q;
+    while (e > p && (e[-1] == ' ' || e[-1] == '\t')) --e;
+    if (e > p) args.emplace_back(p, e);
+    p = q;
+  }
+
+  if (op[0] == '.') Directive(as, op, args);
+  else if (as.sec != SEC_TEXT) Error(as, "instruction outside .text", op);
+  else Instruction(as, op, args);
+}
+
+// 回填本文件 .text 中的跳转, 其余的生成重定位
+static void Resolve(assembler_t &as){
+  for (auto &f : as.fixups){
+    const asm_sym_t &sym = as.syms[f.sym];
+    if (sym.sec != SEC_TEXT){
+      as.syms[f.sym].used = true;
+      as.relocs.push_back(f);
+      continue;
+    }
+    int32_t off = (int32_t)sym.value - (int32_t)f.offset;
+    uint32_t code = Get32(as.text, f.offset);
+    if (f.type == R_RISCV_BRANCH){
+      if (off < -4096 || off >= 4096) Error(as, "branch out of range to", sym.name);
+      code |= B_imm(off);
+    }
+    else{
+      if (off < -(1 << 20) || off >= (1 << 20)) Error(as, "jump out of range to", sym.name);
+      code |= J_imm(off);
+    }
+    Set32(as.text, f.offset, code);
+  }
+}
+
+// 写 ELF32 可重定位目标文件
+// 节的顺序: NULL .text .data .bss .symtab .strtab .rela.text .shstrtab
+static std::vector<uint8_t> Elf(assembler_t &as){
+  // 符号表: 局部符号在前, 全局符号在后
+  // 只在本函数内使用的 .L 标号不写入, 除非被重定位引用
+  std::vector<int> order;
+  std::vector<int> new_index(as.syms.size(), 0);
+  for (int global = 0; global < 2; ++global){
+    for (size_t i = 0; i < as.syms.size(); ++i){
+      const asm_sym_t &sym = as.syms[i];
+      bool is_global = sym.global || sym.sec == 0;
+      if (is_global != (global == 1)) continue;
+      if (sym.sec == 0 && !sym.used && !sym.global) continue;
+      if (!is_global && sym.name.compare(0, 2, ".L") == 0 && !sym.used) continue;
+      new_index[i] = order.size() + 1;
+      order.push_back(i);
+    }
+  }
+  uint32_t first_global = 1;
+  for (int i : order){
+    if (as.syms[i].global || as.syms[i].sec == 0) break;
+    first_global++;
+  }
+
+  std::vector<uint8_t> strtab(1, 0), symtab(16, 0), rela;
+  for (int i : order){
+    const asm_sym_t &sym = as.syms[i];
+    bool is_global = sym.global || sym.sec == 0;
+    int type = sym.sec == SEC_TEXT ? (is_global ? 2 : 0) : (sym.sec == 0 ? 0 : 1);
+    Put32(symtab, strtab.size());
+    Put32(symtab, sym.value);
+    Put32(symtab, 0);
+    symtab.push_back((is_global ? 1 : 0) << 4 | type);
+    symtab.push_back(0);
+    symtab.push_back(sym.sec);
+    symtab.push_back(0);
+    strtab.insert(strtab.end(), sym.name.begin(), sym.name.end());
+    strtab.push_back(0);
+  }
+  for (auto &r : as.relocs){
+    Put32(rela, r.offset);
+    Put32(rela, (uint32_t)new_index[r.sym] << 8 | r.type);
+    Put32(rela, r.addend);
+  }
+
+  static const char shstrtab[] = "\0.text\0.data\0.bss\0.symtab\0.strtab\0.rela.text\0.shstrtab";
+  struct section_t{
+    uint32_t name, type, flags, size, link, info, align, entsize;
+    const std::vector<uint8_t> *content;
+  };
+  std::vector<uint8_t> shstr(shstrtab, shstrtab + sizeof(shstrtab));
+  section_t sections[] = {
+    {0, 0, 0, 0, 0, 0, 0, 0, nullptr},
+    {1, 1, 6, (uint32_t)as.text.size(), 0, 0, 4, 0, &as.text},
+    {7, 1, 3, (uint32_t)as.data.size(), 0, 0, 4, 0, &as.data},
+    {13, 8, 3, as.bss_size, 0, 0, 4, 0, nullptr},
+    {18, 2, 0, (uint32_t)symtab.size(), 5, first_global, 4, 16, &symtab},
+    {26, 3, 0, (uint32_t)strtab.size(), 0, 0, 1, 0, &strtab},
+    {34, 4, 0x40, (uint32_t)rela.size(), 4, 1, 4, 12, &rela},
+    {45, 3, 0, (uint32_t)shstr.size(), 0, 0, 1, 0, &shstr},
+  };
+  const int shnum = sizeof(sections) / sizeof(sections[0]);
+
+  std::vector<uint8_t> out(52, 0);
+  std::vector<uint32_t> offsets(shnum, 0);
+  for (int i = 1; i < shnum; ++i){
+    if (sections[i].content == nullptr) continue;
+    while (out.size() % 4) out.push_back(0);
+    offsets[i] = out.size();
+    out.insert(out.end(), sections[i].content->begin(), sections[i].content->end());
+  }
+  while (out.size() % 4) out.push_back(0);
+  uint32_t shoff = out.size();
+  for (int i = 0; i < shnum; ++i){
+    const section_t &s = sections[i];
+    Put32(out, s.name);
+    Put32(out, s.type);
+    Put32(out, s.flags);
+    Put32(out, 0);
+    Put32(out, offsets[i] ? offsets[i] : (i ? shoff : 0));
+    Put32(out, s.size);
+    Put32(out, s.link);
+    Put32(out, s.info);
+    Put32(out, s.align);
+    Put32(out, s.entsize);
+  }
+
+  // ELF 头
+  static const uint8_t ident[16] = {0x7f, 'E', 'L', 'F', 1, 1, 1, 0};
+  memcpy(out.data(), ident, 16);
+  auto set16 = [&](int pos, uint16_t val){
+    out[pos] = val;
+    out[pos + 1] = val >> 8;
+  };
+  set16(16, 1);         // ET_REL
+  set16(18, 243);       // EM_RISCV
+  Set32(out, 20, 1);    // EV_CURRENT
+  Set32(out, 32, shoff);
+  set16(40, 52);        // e_ehsize
+  set16(46, 40);        // e_shentsize
+  set16(48, shnum);
+  set16(50, shnum - 1); // e_shstrndx
+  return out;
+}
+
+// 把汇编文本编码成目标文件写到 out
+bool write_object(const std::string &text, writer_t &out){
+  assembler_t as;
+  const char *p = text.data(), *end = p + text.size();
+  while (p < end){
+    const char *nl = (const char *)memchr(p, '\n', end - p);
+    if (nl == nullptr) nl = end;
+    as.line++;
+    Line(as, p, nl);
+    p = nl + 1;
+  }
+  Resolve(as);
+  if (!as.ok) return false;
+  std::vector<uint8_t> obj = Elf(as);
+  out.put((const char *)obj.data(), obj.size());
+  return out.ok;
+}
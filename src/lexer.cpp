@@ -0,0 +1,242 @@
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lexer.hpp"
+
+// 把输入文件映射到内存
+// flex 要求缓冲区以两个 '\0' 结尾, 所以先映射一段多出两个字节的匿名内存,
+// 再把文件映射覆盖上去, 文件末尾之后的部分都是 0
+// flex 会在当前 token 的末尾临时写入 '\0', 所以映射是可写的 (私有映射, 不会改动文件)
+char *Map_input(const char *input, size_t &size, size_t &map_size){
+  int fd = open(input, O_RDONLY);
+  if (fd < 0) return nullptr;
+  struct stat st;
+  if (fstat(fd, &st) < 0){
+    close(fd);
+    return nullptr;
+  }
+  size = st.st_size;
+  size_t page = sysconf(_SC_PAGESIZE);
+  map_size = (size + 2 + page - 1) / page * page;
+  char *buf = (char *)mmap(nullptr, map_size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED){
+    close(fd);
+    return nullptr;
+  }
+  if (size > 0 && mmap(buf, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED){
+    munmap(buf, map_size);
+    close(fd);
+    return nullptr;
+  }
+  close(fd);
+  return buf;
+}
+
+void Unmap_input(char *buf, size_t map_size){
+  munmap(buf, map_size);
+}
+
+#ifdef HAND_LEXER
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "sysy.tab.hpp"
+
+using namespace std;
+
+// 字符分类表
+enum {
+  CH_SPACE = 1,   // 空白符
+  CH_IDENT = 2,   // 标识符中的字符
+  CH_DIGIT = 4,   // 十进制数字
+  CH_HEX = 8,     // 十六进制数字
+};
+
+struct char_table_t{
+  unsigned char cls[256];
+  char_table_t(){
+    memset(cls, 0, sizeof(cls));
+    for (const char *p = " \t\n\r"; *p; ++p) cls[(unsigned char)*p] |= CH_SPACE;
+    for (int c = 'a'; c <= 'z'; ++c) cls[c] |= CH_IDENT;
+    for (int c = 'A'; c <= 'Z'; ++c) cls[c] |= CH_IDENT;
+    for (int c = '0'; c <= '9'; ++c) cls[c] |= CH_IDENT | CH_DIGIT | CH_HEX;
+    for (int c = 'a'; c <= 'f'; ++c) cls[c] |= CH_HEX;
+    for (int c = 'A'; c <= 'F'; ++c) cls[c] |= CH_HEX;
+    cls['_'] |= CH_IDENT;
+  }
+};
+static const char_table_t char_table;
+
+static inline bool Is(char c, int cls){
+  return char_table.cls[(unsigned char)c] & cls;
+}
+
+// 关键字的完美哈希: (最后一个字符 * 4 + 长度) % 16, 9 个关键字互不冲突
+struct keyword_t{
+  const char *name;
+  int len, token;
+};
+static const keyword_t keywords[16] = {
+  {nullptr, 0, 0},    {"break", 5, BREAK},  {nullptr, 0, 0},       {"int", 3, INT},
+  {"void", 4, VOID},  {"const", 5, CONST},  {nullptr, 0, 0},       {nullptr, 0, 0},
+  {"else", 4, ELSE},  {"while", 5, WHILE},  {"if", 2, IF},         {nullptr, 0, 0},
+  {"continue", 8, CONTINUE}, {nullptr, 0, 0}, {"return", 6, RETURN}, {nullptr, 0, 0},
+};
+
+static inline int Keyword(const char *p, int len){
+  const keyword_t &kw = keywords[((unsigned char)p[len - 1] * 4 + len) & 15];
+  if (kw.len == len && memcmp(kw.name, p, len) == 0) return kw.token;
+  return IDENT;
+}
+
+// 跳过空白符, 有 SSE2 时一次比较 16 个字节
+static inline const char *Skip_space(const char *p, const char *end){
+#ifdef __SSE2__
+  const __m128i sp = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i nl = _mm_set1_epi8('\n');
+  const __m128i cr = _mm_set1_epi8('\r');
+  while (end - p >= 16){
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)),
+                             _mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, cr)));
+    unsigned mask = ~_mm_movemask_epi8(m) & 0xffff;
+    if (mask) return p + __builtin_ctz(mask);
+    p += 16;
+  }
+#endif
+  while (p < end && Is(*p, CH_SPACE)) ++p;
+  return p;
+}
+
+// 跳过块注释, p 指向 "/*" 之后, 返回 "*/" 之后的位置, 没有结尾时返回 nullptr
+// memchr 由 libc 向量化实现
+static inline const char *Skip_block_comment(const char *p, const char *end){
+  while (p < end){
+    const char *star = (const char *)memchr(p, '*', end - p);
+    if (star == nullptr || star + 1 >= end) return nullptr;
+    if (star[1] == '/') return star + 2;
+    p = star + 1;
+  }
+  return nullptr;
+}
+
+// 按进制累加一位数字, 超过 LONG_MAX 后饱和在 LONG_MAX, 与 strtol 溢出时的返回值相同
+static inline void Add_digit(long &val, int base, int digit){
+  if (val > (LONG_MAX - digit) / base) val = LONG_MAX;
+  else val = val * base + digit;
+}
+
+// 与 flex 规则保持一致:
+// Decimal [1-9][0-9]*, Octal 0[0-7]*, Hexadecimal 0[xX][0-9a-fA-F]+
+// 数值先按 strtol 的方式计算 (溢出时饱和为 LONG_MAX), 再同样截断到 int
+static inline const char *Scan_number(const char *p, const char *end, int &value){
+  long val = 0;
+  if (*p != '0'){
+    while (p < end && Is(*p, CH_DIGIT)) Add_digit(val, 10, *p++ - '0');
+  }
+  else if (end - p > 2 && (p[1] == 'x' || p[1] == 'X') && Is(p[2], CH_HEX)){
+    p += 2;
+    while (p < end && Is(*p, CH_HEX)){
+      int c = *p++;
+      Add_digit(val, 16, c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+    }
+  }
+  else{
+    ++p;
+    while (p < end && *p >= '0' && *p <= '7') Add_digit(val, 8, *p++ - '0');
+  }
+  value = (int)val;
+  return p;
+}
+
+int yylex(YYSTYPE *yylval, void *scanner){
+  hand_lexer_t *lexer = (hand_lexer_t *)scanner;
+  const char *p = lexer->cur, *end = lexer->end;
+  for (;;){
+    p = Skip_space(p, end);
+    if (p >= end){
+      lexer->cur = p;
+      return 0;
+    }
+    if (p[0] == '/' && p + 1 < end && p[1] == '/'){
+      const char *nl = (const char *)memchr(p, '\n', end - p);
+      p = nl ? nl : end;
+      continue;
+    }
+    if (p[0] == '/' && p + 1 < end && p[1] == '*'){
+      const char *q = Skip_block_comment(p + 2, end);
+      if (q != nullptr){
+        p = q;
+        continue;
+      }
+    }
+    break;
+  }
+
+  const char *start = p;
+  int token;
+  if (Is(*p, CH_DIGIT)){
+    p = Scan_number(p, end, yylval->int_val);
+    token = INT_CONST;
+  }
+  else if (Is(*p, CH_IDENT)){
+    while (p < end && Is(*p, CH_IDENT)) ++p;
+    int len = p - start;
+    token = len <= 8 ? Keyword(start, len) : IDENT;
+    if (token == IDENT){
+      yylval->ident_val.ptr = start;
+      yylval->ident_val.len = len;
+    }
+  }
+  else{
+    char c = *p++, n = p < end ? *p : '\0';
+    token = (unsigned char)c;
+    if (n == '='){
+      if (c == '<') token = LE;
+      else if (c == '>') token = GE;
+      else if (c == '=') token = EQ;
+      else if (c == '!') token = NE;
+    }
+    else if (c == '&' && n == '&') token = AND;
+    else if (c == '|' && n == '|') token = OR;
+    if (token != (unsigned char)c) ++p;
+  }
+  lexer->cur = p;
+  return token;
+}
+
+// 解析输入文件, 与 sysy.l 中 flex 版本的接口相同
+int parse_file(const char *input, unique_ptr<BaseAST> &ast, exp_pool_t &pool){
+  size_t size, map_size;
+  char *buf = Map_input(input, size, map_size);
+  if (buf == nullptr) return -1;
+  hand_lexer_t lexer = {buf, buf + size};
+  int ret = yyparse(ast, pool, &lexer);
+  Unmap_input(buf, map_size);
+  return ret;
+}
+
+// 只做词法分析, 返回 token 数量, 用于比较两种 lexer 的速度
+long long lex_file(const char *input){
+  size_t size, map_size;
+  char *buf = Map_input(input, size, map_size);
+  if (buf == nullptr) return -1;
+  hand_lexer_t lexer = {buf, buf + size};
+  YYSTYPE lval;
+  long long count = 0;
+  while (yylex(&lval, &lexer)) ++count;
+  Unmap_input(buf, map_size);
+  return count;
+}
+
+#endif
@@ -0,0 +1,14 @@
+#pragma once
+#include <cstddef>
+
+// 把输入文件映射到内存, 末尾保证至少有两个 '\0'
+// 成功时返回缓冲区, size 为文件大小, map_size 为映射的总大小
+char *Map_input(const char *input, size_t &size, size_t &map_size);
+void Unmap_input(char *buf, size_t map_size);
+
+// 手写 lexer 的状态, 用 make LEXER=hand 编译时代替 flex 生成的 lexer
+// cur 指向下一个待扫描的字符, end 指向输入末尾
+struct hand_lexer_t{
+  const char *cur;
+  const char *end;
+};
@@ -2,87 +2,120 @@
 #include <cstdio>
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
 #include <memory>
 #include <string>
 #include <stack>
 #include <map>
+#include <fcntl.h>
+#include <unistd.h>
 #include "ast.hpp"
 #include "sym.hpp"
+#include "writer.hpp"
 
 using namespace std;
 
-// 声明 lexer 的输入, 以及 parser 函数
-// 为什么不引用 sysy.tab.hpp 呢? 因为首先里面没有 yyin 的定义
-// 其次, 因为这个文件不是我们自己写的, 而是被 Bison 生成出来的
+// 声明解析函数, 定义在 sysy.l (或手写 lexer 的 lexer.cpp) 中, 负责映射输入文件并调用 parser
+// 为什么不引用 sysy.tab.hpp 呢? 因为这个文件不是我们自己写的, 而是被 Bison 生成出来的
 // 你的代码编辑器/IDE 很可能找不到这个文件, 然后会给你报错 (虽然编译不会出错)
 // 看起来会很烦人, 于是干脆采用这种看起来 dirty 但实际很有效的手段
-extern FILE *yyin;
-extern FILE *yyout;
-extern int yyparse(unique_ptr<BaseAST> &ast);
-extern void solve_koopa(char *str);
-void init_str(char *str, std::map<std::string, sym_t>* val_ma);
-
-int cnt;
-stack<num_t>* val_st = new stack<num_t>;
-stack<int>* loop_cur = new stack<int>;
-map<string, sym_t>* val_ma = new map<string, sym_t>;
+extern int parse_file(const char *input, unique_ptr<BaseAST> &ast, exp_pool_t &pool);
+extern long long lex_file(const char *input);
+extern void solve_koopa(const char *str, string &out);
+extern bool write_object(const string &text, writer_t &out);
+extern void analyze(BaseAST *root, dump_ctx_t &ctx);
+extern unsigned long long cache_key(const char *input, int argc, const char *argv[]);
+extern int opt_level;
+extern bool target_rvv;
+extern bool cache_fetch(unsigned long long key, const char *output);
+extern void cache_store(unsigned long long key, const char *output);
+void init_str(dump_ctx_t &ctx);
 
 int main(int argc, const char *argv[]) {
     // 解析命令行参数. 测试脚本/评测平台要求你的编译器能接收如下参数:
     // compiler 模式 输入文件 -o 输出文件
-    assert(argc == 5);
+    // 之后还可以跟 -O<n> 指定优化级别, 默认为 0; -O3 打开记忆化; -rvv 表示目标支持向量扩展
+    assert(argc >= 5);
     auto mode = argv[1];
     auto input = argv[2];
     auto output = argv[4];
+    for (int i = 5; i < argc; ++i){
+        if (argv[i][0] == '-' && argv[i][1] == 'O') opt_level = atoi(argv[i] + 2);
+#ifdef ENABLE_RVV
+        // 向量化还没有在支持 V 扩展的模拟器上验证过, 只有 make RVV=1 构建的编译器接受 -rvv
+        else if (strcmp(argv[i], "-rvv") == 0) target_rvv = true;
+#endif
+        else cerr << "Unknown Parameters!" << endl;
+    }
 
-    char *str = (char *)malloc(10000 * sizeof(char));
+    // 相同的输入和编译选项之前编译过, 直接使用缓存的结果
+    auto key = cache_key(input, argc, argv);
+    if (cache_fetch(key, output)) return 0;
 
-    // 打开输入文件, 并且指定 lexer 在解析的时候读取这个文件
-    yyin = freopen(input, "r", stdin);
-    assert(yyin);
+    // 打开输出文件, 所有输出都经过 writer 缓冲后直接 write, 不经过 stdio
+    int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert(fd >= 0);
+    writer_t out(fd);
 
-    // 打开输出文件
-    yyout = freopen(output, "w", stdout);
-    // assert(yyout);
+    dump_ctx_t ctx;
+    // init_str(ctx);gg
 
-    // init_str(str, val_ma);gg
+    // -lex 只做词法分析并输出 token 数量, 用于比较 lexer 的速度
+    if (mode[1] == 'l'){
+        out.put(to_string(lex_file(input)) + "\n");
+        out.flush();
+        close(fd);
+        return 0;
+    }
 
     // 调用 parser 函数, parser 函数会进一步调用 lexer 解析输入文件的
+    // 表达式的节点存放在 pool 中, 其余节点组成 ast
+    exp_pool_t pool;
+    ctx.pool = &pool;
     unique_ptr<BaseAST> ast;
-    auto ret = yyparse(ast);
+    auto ret = parse_file(input, ast, pool);
     assert(!ret);
     
+    // 语义分析, 解析标识符并求出常量, 结果记在 AST 节点上
+    analyze(ast.get(), ctx);
+
     // 输出解析得到的 AST, 其实就是个字符串
-    ast->Dump(str, cnt, loop_cur, val_st, 0, val_ma);
+    ast->Dump(ctx, 0);
     if (mode[1] == 'k'){
-        cout << str;
+        out.put(ctx.str);
     } else if (mode[1] == 'r'){
-        solve_koopa(str);
+        string riscv;
+        solve_koopa(ctx.str.c_str(), riscv);
+        out.put(riscv);
+    } else if (mode[1] == 'o'){
+        // -obj 直接输出 ELF 目标文件, 不需要再调用汇编器
+        string riscv;
+        solve_koopa(ctx.str.c_str(), riscv);
+        auto ok = write_object(riscv, out);
+        assert(ok);
     } else {
         cerr << "Unknown Parameters!" << endl;
     }
 
-    (*val_ma).clear();
-    free(val_st);
-    free(loop_cur);
-    free(val_ma);
-    free(str);
-
-    fclose(stdin);
-    fclose(stdout);
+    auto ok = out.flush();
+    assert(ok);
+    close(fd);
+    cache_store(key, output);
+    // 很深的 AST 递归析构会爆栈, 进程马上退出, 内存直接交给操作系统回收
+    ast.release();
     return 0;
 }
 
-void init_str(char *str, std::map<std::string, sym_t>* val_ma){
+void init_str(dump_ctx_t &ctx){
   char stmp[50];
   sprintf(stmp, "decl @getint(): i32\ndecl @getch(): i32\n");
-  strcat(str, stmp);
+  ctx.str += stmp;
   sprintf(stmp, "decl @getarray(*i32): i32\ndecl @putint(i32)\n");
-  strcat(str, stmp);
+  ctx.str += stmp;
   sprintf(stmp, "decl @putch(i32)\ndecl @putarray(i32, *i32)\n");
-  strcat(str, stmp);
+  ctx.str += stmp;
   sprintf(stmp, "decl @starttime()\ndecl @stoptime()\n\n");
-  strcat(str, stmp);
+  ctx.str += stmp;
 
   sym_t tmp_loop;
   tmp_loop.val_t = 0;
@@ -90,21 +123,21 @@ void init_str(char *str, std::map<std::string, sym_t>* val_ma){
 
   tmp_loop.type = 2;
   s = "getint";
-  (*val_ma)[s] = tmp_loop;
+  ctx.val_ma[s] = tmp_loop;
   s = "getch";
-  (*val_ma)[s] = tmp_loop;
+  ctx.val_ma[s] = tmp_loop;
   s = "getarray";
-  (*val_ma)[s] = tmp_loop;
+  ctx.val_ma[s] = tmp_loop;
 
   tmp_loop.type = 3;
   s = "putint";
-  (*val_ma)[s] = tmp_loop;
+  ctx.val_ma[s] = tmp_loop;
   s = "putch";
-  (*val_ma)[s] = tmp_loop;
+  ctx.val_ma[s] = tmp_loop;
   s = "putarray";
-  (*val_ma)[s] = tmp_loop;
+  ctx.val_ma[s] = tmp_loop;
   s = "starttime";
-  (*val_ma)[s] = tmp_loop;
+  ctx.val_ma[s] = tmp_loop;
   s = "stoptime";
-  (*val_ma)[s] = tmp_loop;
+  ctx.val_ma[s] = tmp_loop;
 }
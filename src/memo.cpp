@@ -0,0 +1,101 @@
+#include <string>
+#include <vector>
+#include "mir.hpp"
+
+// 记忆化
+// 无副作用的递归函数在 -O3 下拆成两部分: 原来的函数体改名为 <name>.body, 原来的名字换成一个包装函数.
+// 包装函数把参数散列到 .bss 里一张直接映射的表, 命中时直接返回; 否则调用函数体, 再把结果填进表里.
+// 函数体里的递归调用仍然调用原来的名字, 所以每个子问题只算一次
+
+// 每张表的字节数上限
+static const int MEMO_BYTES = 1 << 16;
+
+// 表项的字数: 有效位, 各个参数, 返回值, 补齐到 2 的幂
+static int Entry_words(int nargs){
+  int words = 1;
+  while (words < nargs + 2) words *= 2;
+  return words;
+}
+
+// 表的项数, 为 2 的幂
+static int Entries(int nargs){
+  return MEMO_BYTES / (Entry_words(nargs) * 4);
+}
+
+static minst_t Mem(mop_t op, int reg, int base, int imm){
+  return op == mop_t::LW ? Minst(op, reg, base, NOREG, imm) : Minst(op, NOREG, base, reg, imm);
+}
+
+static minst_t Jump_to(mop_t op, int rs1, int rs2, int target){
+  minst_t inst = Minst(op, NOREG, rs1, rs2);
+  inst.target = target;
+  return inst;
+}
+
+// 生成包装函数, 参数都在 a0~a7 中; 返回表的字节数
+// 块的顺序: 0 算表项地址并检查有效位, 1~n 逐个比较参数, n+1 命中返回, n+2 未命中时调用函数体并填表
+int memo_wrapper(mfunc_t &func, const std::string &body, const std::string &table, int nargs){
+  int words = Entry_words(nargs), shift = 0;
+  while ((1 << shift) < words * 4) shift++;
+  int hit = nargs + 1, miss = nargs + 2;
+  func.blocks.resize(nargs + 3);
+  for (size_t i = 0; i < func.blocks.size(); ++i){
+    func.blocks[i].label = ".L" + func.name + "_" + std::to_string(i);
+  }
+  func.has_call = true;
+
+  // 散列: h = h * 31 + a_i, 取低位作为下标
+  auto &entry = func.blocks[0].insts;
+  std::vector<int> args(nargs);
+  for (int i = 0; i < nargs; ++i){
+    args[i] = func.New_reg();
+    entry.push_back(Minst(mop_t::MV, args[i], A0 + i));
+  }
+  int h = args[0];
+  for (int i = 1; i < nargs; ++i){
+    int k = func.New_reg(), prod = func.New_reg(), sum = func.New_reg();
+    entry.push_back(Minst(mop_t::LI, k, NOREG, NOREG, 31));
+    entry.push_back(Minst(mop_t::MUL, prod, h, k));
+    entry.push_back(Minst(mop_t::ADD, sum, prod, args[i]));
+    h = sum;
+  }
+  int mask = func.New_reg(), index = func.New_reg(), offset = func.New_reg();
+  int base = func.New_reg(), addr = func.New_reg(), valid = func.New_reg();
+  entry.push_back(Minst(mop_t::LI, mask, NOREG, NOREG, Entries(nargs) - 1));
+  entry.push_back(Minst(mop_t::AND, index, h, mask));
+  entry.push_back(Minst(mop_t::SLLI, offset, index, NOREG, shift));
+  minst_t la = Minst(mop_t::LA, base);
+  la.sym = table;
+  entry.push_back(la);
+  entry.push_back(Minst(mop_t::ADD, addr, base, offset));
+  entry.push_back(Mem(mop_t::LW, valid, addr, 0));
+  entry.push_back(Jump_to(mop_t::BEQZ, valid, NOREG, miss));
+
+  for (int i = 0; i < nargs; ++i){
+    int key = func.New_reg();
+    auto &check = func.blocks[i + 1].insts;
+    check.push_back(Mem(mop_t::LW, key, addr, (i + 1) * 4));
+    check.push_back(Jump_to(mop_t::BNE, key, args[i], miss));
+  }
+
+  int value = func.New_reg();
+  auto &found = func.blocks[hit].insts;
+  found.push_back(Mem(mop_t::LW, value, addr, (nargs + 1) * 4));
+  found.push_back(Minst(mop_t::MV, A0, value));
+  found.push_back(Minst(mop_t::RET, NOREG, NOREG, NOREG, 1));
+
+  int one = func.New_reg(), result = func.New_reg();
+  auto &fill = func.blocks[miss].insts;
+  for (int i = 0; i < nargs; ++i) fill.push_back(Minst(mop_t::MV, A0 + i, args[i]));
+  minst_t call = Minst(mop_t::CALL, NOREG, NOREG, NOREG, nargs);
+  call.sym = body;
+  fill.push_back(call);
+  fill.push_back(Minst(mop_t::MV, result, A0));
+  fill.push_back(Minst(mop_t::LI, one, NOREG, NOREG, 1));
+  fill.push_back(Mem(mop_t::SW, one, addr, 0));
+  for (int i = 0; i < nargs; ++i) fill.push_back(Mem(mop_t::SW, args[i], addr, (i + 1) * 4));
+  fill.push_back(Mem(mop_t::SW, result, addr, (nargs + 1) * 4));
+  fill.push_back(Minst(mop_t::MV, A0, result));
+  fill.push_back(Minst(mop_t::RET, NOREG, NOREG, NOREG, 1));
+  return Entries(nargs) * words * 4;
+}
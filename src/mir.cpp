@@ -0,0 +1,341 @@
+#include <cassert>
+#include <algorithm>
+#include <cstdarg>
+#include <functional>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+#include "mir.hpp"
+#include "writer.hpp"
+
+// 机器指令的后端流程: 寄存器分配, 栈帧布局, 输出汇编
+
+static const char *reg_name[32] = {
+  "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+  "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+  "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+  "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+};
+
+// 按 mop_t 的顺序排列, 补齐到 6 个字符和原来的输出对齐; 更长的向量指令后面只跟一个空格
+static const char *op_name[] = {
+  "li    ", "la    ", "lui   ",
+  "mv    ", "seqz  ", "snez  ",
+  "add   ", "sub   ", "mul   ", "div   ", "rem   ", "and   ", "or    ", "xor   ",
+  "sll   ", "srl   ", "sra   ", "slt   ",
+  "addi  ", "andi  ", "ori   ", "xori  ", "slli  ", "srli  ", "srai  ", "slti  ",
+  "lw    ",
+  "sw    ",
+  "beq   ", "bne   ", "blt   ", "bge   ",
+  "beqz  ", "bnez  ",
+  "j     ",
+  "call  ",
+  "ret",
+  "tail  ",
+  "vsetvli ", "vid.v ", "vmv.v.x ", "vmv.s.x ", "vmv.x.s ", "vadd.vx ",
+  "vadd.vv ", "vsub.vv ", "vmul.vv ", "vdiv.vv ", "vrem.vv ", "vredsum.vs ",
+};
+
+static void Put(std::string &out, const char *fmt, ...){
+  va_list args;
+  va_start(args, fmt);
+  Format(out, fmt, args);
+  va_end(args);
+}
+
+// 寄存器分配
+// 每个虚拟寄存器分到自己的栈槽, 使用前装入临时寄存器, 定值后立即存回
+// 这样每条指令之间没有寄存器保持活跃, call 前后不需要保存任何寄存器
+// 临时寄存器轮流使用, 刚存回的值在后面几条指令里还留在寄存器中, 窥孔优化可以省掉重新装入
+static const int scratch[] = {T0, T1, T2, 28, 29, 30};
+
+void alloc_regs(mfunc_t &func){
+  std::vector<int> slot(func.vregs - VREG, -1);
+  auto slot_of = [&](int reg){
+    if (slot[reg - VREG] < 0) slot[reg - VREG] = func.New_slot(4);
+    return slot[reg - VREG];
+  };
+  size_t next = 0;
+  auto take = [&](){
+    int reg = scratch[next];
+    next = (next + 1) % (sizeof(scratch) / sizeof(scratch[0]));
+    return reg;
+  };
+  for (auto &bb : func.blocks){
+    std::vector<minst_t> insts;
+    insts.reserve(bb.insts.size() * 3);
+    for (auto inst : bb.insts){
+      if (Is_vreg(inst.rs1)){
+        int reg = take();
+        insts.push_back(Load_slot(reg, slot_of(inst.rs1)));
+        if (inst.rs2 == inst.rs1) inst.rs2 = reg;
+        inst.rs1 = reg;
+      }
+      if (Is_vreg(inst.rs2)){
+        int reg = take();
+        insts.push_back(Load_slot(reg, slot_of(inst.rs2)));
+        inst.rs2 = reg;
+      }
+      int def = inst.rd;
+      if (Is_vreg(def)) inst.rd = take();
+      insts.push_back(inst);
+      if (Is_vreg(def)) insts.push_back(Store_slot(inst.rd, slot_of(def)));
+    }
+    bb.insts.swap(insts);
+  }
+}
+
+// 调整 sp, 超出 12 位立即数时借用 t6
+static void Adjust_sp(std::vector<minst_t> &insts, int delta){
+  if (Fits_imm12(delta)){
+    insts.push_back(Minst(mop_t::ADDI, SP, SP, NOREG, delta));
+  }
+  else{
+    insts.push_back(Minst(mop_t::LI, T6, NOREG, NOREG, delta));
+    insts.push_back(Minst(mop_t::ADD, SP, SP, T6));
+  }
+}
+
+// 逆向数据流求每个块入口和出口处活跃的栈槽, 即之后还可能被 lw 读到的栈槽
+void slot_liveness(const mfunc_t &func, std::vector<slots_t> &live_in, std::vector<slots_t> &live_out){
+  size_t n = func.frame.size(), nb = func.blocks.size();
+  // 块内的读 (在写之前) 和写
+  std::vector<slots_t> use(nb, slots_t(n)), def(nb, slots_t(n));
+  for (size_t b = 0; b < nb; ++b){
+    for (auto &inst : func.blocks[b].insts){
+      if (inst.slot < 0) continue;
+      if (inst.op == mop_t::SW) def[b].Add(inst.slot);
+      else if (!def[b].Has(inst.slot)) use[b].Add(inst.slot);
+    }
+  }
+
+  live_in.assign(nb, slots_t(n));
+  live_out.assign(nb, slots_t(n));
+  bool changed = true;
+  while (changed){
+    changed = false;
+    for (size_t b = nb; b-- > 0;){
+      slots_t out(n);
+      for (int s : Succs(func, b)){
+        for (size_t k = 0; k < out.bits.size(); ++k) out.bits[k] |= live_in[s].bits[k];
+      }
+      slots_t in = out;
+      for (size_t k = 0; k < in.bits.size(); ++k) in.bits[k] = (out.bits[k] & ~def[b].bits[k]) | use[b].bits[k];
+      if (in.bits != live_in[b].bits || out.bits != live_out[b].bits){
+        live_in[b] = in;
+        live_out[b] = out;
+        changed = true;
+      }
+    }
+  }
+}
+
+// 按活跃区间给 4 字节的栈槽分配偏移, 活跃区间不重叠的栈槽共用同一个位置
+// 指令按块的顺序线性编号, 每个栈槽的活跃区间取它所有活跃点的最小区间, 之后像线性扫描分配寄存器一样复用位置
+// 数组等更大的对象各占自己的空间; 从未被访问的对象不占空间
+// 返回分配出的字节数, 偏移从 base 开始
+static int Color_slots(mfunc_t &func, int base){
+  size_t n = func.frame.size(), nb = func.blocks.size();
+  auto colored = [&](int s){ return func.frame[s].arg < 0 && func.frame[s].size == 4; };
+
+  std::vector<bool> touched(n, false);
+  for (auto &bb : func.blocks){
+    for (auto &inst : bb.insts){
+      if (inst.slot >= 0) touched[inst.slot] = true;
+    }
+  }
+  std::vector<slots_t> live_in, live_out;
+  slot_liveness(func, live_in, live_out);
+
+  // 活跃区间
+  std::vector<int> first(n, -1), last(n, -1);
+  auto cover = [&](int s, int point){
+    if (first[s] < 0 || point < first[s]) first[s] = point;
+    if (point > last[s]) last[s] = point;
+  };
+  int point = 0;
+  for (size_t b = 0; b < nb; ++b){
+    int start = point;
+    for (auto &inst : func.blocks[b].insts){
+      if (inst.slot >= 0) cover(inst.slot, point);
+      point++;
+    }
+    for (size_t s = 0; s < n; ++s){
+      if (live_in[b].Has(s)) cover(s, start);
+      if (live_out[b].Has(s)) cover(s, point);
+    }
+    point++;
+  }
+
+  // 按区间起点依次分配, 复用区间已经结束的位置
+  std::vector<int> order;
+  for (size_t s = 0; s < n; ++s){
+    if (touched[s] && colored(s)) order.push_back(s);
+  }
+  std::sort(order.begin(), order.end(), [&](int a, int b){ return first[a] < first[b]; });
+  // (区间终点, 偏移), 按终点从小到大
+  std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::greater<std::pair<int, int>>> active;
+  std::vector<int> free_offsets;
+  int size = 0;
+  for (int s : order){
+    while (!active.empty() && active.top().first < first[s]){
+      free_offsets.push_back(active.top().second);
+      active.pop();
+    }
+    int offset;
+    if (free_offsets.empty()){
+      offset = base + size;
+      size += 4;
+    }
+    else{
+      offset = free_offsets.back();
+      free_offsets.pop_back();
+    }
+    func.frame[s].offset = offset;
+    active.push({last[s], offset});
+  }
+
+  for (size_t s = 0; s < n; ++s){
+    if (!touched[s] || func.frame[s].arg >= 0 || colored(s)) continue;
+    func.frame[s].offset = base + size;
+    size += func.frame[s].size;
+  }
+  return size;
+}
+
+// 栈帧布局
+// 从 sp 往上依次是: 传给被调用函数的栈上参数, 4 字节的栈槽, 数组等大的对象, 保存的 ra
+// 小的对象靠近 sp, 偏移尽量落在 12 位立即数的范围内; 栈帧大小按 ABI 对齐到 16 字节
+// 确定各对象的偏移后改写访存指令, 并插入序言和尾声
+void layout_frame(mfunc_t &func){
+  int offset = func.out_args + Color_slots(func, func.out_args);
+  int ra_slot = -1;
+  if (func.has_call){
+    ra_slot = func.New_slot(4);
+    func.frame[ra_slot].offset = offset;
+    offset += 4;
+  }
+  func.frame_size = (offset + 15) / 16 * 16;
+  for (auto &obj : func.frame){
+    if (obj.arg >= 0) obj.offset = func.frame_size + (obj.arg - ARG_REGS) * 4;
+  }
+
+  for (size_t i = 0; i < func.blocks.size(); ++i){
+    auto &bb = func.blocks[i];
+    std::vector<minst_t> insts;
+    insts.reserve(bb.insts.size() + 4);
+    // 序言
+    if (i == 0){
+      if (func.frame_size) Adjust_sp(insts, -func.frame_size);
+      if (ra_slot >= 0) insts.push_back(Store_slot(RA, ra_slot));
+    }
+    for (auto &inst : bb.insts){
+      // 尾声, 尾调用前也要拆掉栈帧
+      if (Is_exit(inst.op)){
+        if (ra_slot >= 0) insts.push_back(Load_slot(RA, ra_slot));
+        if (func.frame_size) Adjust_sp(insts, func.frame_size);
+      }
+      insts.push_back(inst);
+    }
+
+    // 栈帧对象换成实际偏移, 偏移超出 12 位立即数时先用 t6 算出地址
+    std::vector<minst_t> legal;
+    legal.reserve(insts.size());
+    for (auto inst : insts){
+      if (inst.slot >= 0){
+        inst.imm += func.frame[inst.slot].offset;
+        inst.slot = -1;
+      }
+      if ((inst.op == mop_t::LW || inst.op == mop_t::SW) && !Fits_imm12(inst.imm)){
+        legal.push_back(Minst(mop_t::LI, T6, NOREG, NOREG, inst.imm));
+        legal.push_back(Minst(mop_t::ADD, T6, inst.rs1, T6));
+        inst.rs1 = T6;
+        inst.imm = 0;
+      }
+      legal.push_back(inst);
+    }
+    bb.insts.swap(legal);
+  }
+}
+
+// 输出一条指令
+static void Emit_inst(const mfunc_t &func, const minst_t &inst, std::string &out){
+  const char *op = op_name[(int)inst.op];
+  assert(inst.rd < VREG && inst.rs1 < VREG && inst.rs2 < VREG);
+  switch (inst.op){
+    case mop_t::LI:
+      Put(out, "  %s%s, %d\n", op, reg_name[inst.rd], inst.imm);
+      break;
+    case mop_t::LA:
+      Put(out, "  %s%s, %s\n", op, reg_name[inst.rd], inst.sym.c_str());
+      break;
+    case mop_t::LUI:
+      Put(out, "  %s%s, %%hi(%s)\n", op, reg_name[inst.rd], inst.sym.c_str());
+      break;
+    case mop_t::MV: case mop_t::SEQZ: case mop_t::SNEZ:
+      Put(out, "  %s%s, %s\n", op, reg_name[inst.rd], reg_name[inst.rs1]);
+      break;
+    case mop_t::ADD: case mop_t::SUB: case mop_t::MUL: case mop_t::DIV: case mop_t::REM:
+    case mop_t::AND: case mop_t::OR: case mop_t::XOR: case mop_t::SLL: case mop_t::SRL:
+    case mop_t::SRA: case mop_t::SLT:
+      Put(out, "  %s%s, %s, %s\n", op, reg_name[inst.rd], reg_name[inst.rs1], reg_name[inst.rs2]);
+      break;
+    case mop_t::ADDI: case mop_t::ANDI: case mop_t::ORI: case mop_t::XORI: case mop_t::SLLI:
+    case mop_t::SRLI: case mop_t::SRAI: case mop_t::SLTI:
+      Put(out, "  %s%s, %s, %d\n", op, reg_name[inst.rd], reg_name[inst.rs1], inst.imm);
+      break;
+    case mop_t::LW:
+      if (inst.sym.empty()) Put(out, "  %s%s, %d(%s)\n", op, reg_name[inst.rd], inst.imm, reg_name[inst.rs1]);
+      else Put(out, "  %s%s, %%lo(%s)(%s)\n", op, reg_name[inst.rd], inst.sym.c_str(), reg_name[inst.rs1]);
+      break;
+    case mop_t::SW:
+      if (inst.sym.empty()) Put(out, "  %s%s, %d(%s)\n", op, reg_name[inst.rs2], inst.imm, reg_name[inst.rs1]);
+      else Put(out, "  %s%s, %%lo(%s)(%s)\n", op, reg_name[inst.rs2], inst.sym.c_str(), reg_name[inst.rs1]);
+      break;
+    case mop_t::BEQ: case mop_t::BNE: case mop_t::BLT: case mop_t::BGE:
+      Put(out, "  %s%s, %s, %s\n", op, reg_name[inst.rs1], reg_name[inst.rs2],
+          func.blocks[inst.target].label.c_str());
+      break;
+    case mop_t::BEQZ: case mop_t::BNEZ:
+      Put(out, "  %s%s, %s\n", op, reg_name[inst.rs1], func.blocks[inst.target].label.c_str());
+      break;
+    case mop_t::J:
+      Put(out, "  %s%s\n", op, func.blocks[inst.target].label.c_str());
+      break;
+    case mop_t::CALL: case mop_t::TAIL:
+      Put(out, "  %s%s\n", op, inst.sym.c_str());
+      break;
+    case mop_t::RET:
+      Put(out, "  %s\n", op);
+      break;
+    case mop_t::VSETVLI:
+      Put(out, "  %s%s, %s, e32, m1, %s\n", op, reg_name[inst.rd], reg_name[inst.rs1], inst.imm ? "tu, mu" : "ta, ma");
+      break;
+    case mop_t::VID:
+      Put(out, "  %sv%d\n", op, inst.vd);
+      break;
+    case mop_t::VMV_V_X: case mop_t::VMV_S_X:
+      Put(out, "  %sv%d, %s\n", op, inst.vd, reg_name[inst.rs1]);
+      break;
+    case mop_t::VMV_X_S:
+      Put(out, "  %s%s, v%d\n", op, reg_name[inst.rd], inst.vs2);
+      break;
+    case mop_t::VADD_VX:
+      Put(out, "  %sv%d, v%d, %s\n", op, inst.vd, inst.vs2, reg_name[inst.rs1]);
+      break;
+    case mop_t::VADD_VV: case mop_t::VSUB_VV: case mop_t::VMUL_VV: case mop_t::VDIV_VV:
+    case mop_t::VREM_VV: case mop_t::VREDSUM_VS:
+      Put(out, "  %sv%d, v%d, v%d\n", op, inst.vd, inst.vs2, inst.vs1);
+      break;
+  }
+}
+
+// 输出汇编文本, 入口块紧跟在函数名后面, 不需要标号
+void emit_func(const mfunc_t &func, std::string &out){
+  Put(out, "%s:\n", func.name.c_str());
+  for (size_t i = 0; i < func.blocks.size(); ++i){
+    if (i > 0) Put(out, "%s:\n", func.blocks[i].label.c_str());
+    for (auto &inst : func.blocks[i].insts) Emit_inst(func, inst, out);
+  }
+}
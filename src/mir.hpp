@@ -0,0 +1,219 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// 机器指令层
+// 指令选择 (rawp.cpp) 把 Koopa IR 翻译成 RISC-V 指令, 操作数先用虚拟寄存器,
+// 局部变量先放在抽象的栈帧对象里; 之后依次经过寄存器分配, 栈帧布局,
+// 最后才输出成汇编文本 (mir.cpp). 后端的优化都在这一层上做
+
+// 寄存器编号: 0~31 是物理寄存器 x0~x31, 从 VREG 开始是虚拟寄存器
+enum {
+  NOREG = -1,
+  ZERO = 0, RA = 1, SP = 2, GP = 3,
+  T0 = 5, T1 = 6, T2 = 7,
+  A0 = 10,
+  T6 = 31,
+  VREG = 32,
+};
+
+// 参数寄存器 a0~a7 的个数
+const int ARG_REGS = 8;
+
+// 机器指令的操作码
+enum class mop_t {
+  // rd, imm
+  LI,
+  // rd, sym
+  LA,
+  // rd, %hi(sym)
+  LUI,
+  // rd, rs1
+  MV, SEQZ, SNEZ,
+  // rd, rs1, rs2
+  ADD, SUB, MUL, DIV, REM, AND, OR, XOR, SLL, SRL, SRA, SLT,
+  // rd, rs1, imm
+  ADDI, ANDI, ORI, XORI, SLLI, SRLI, SRAI, SLTI,
+  // rd, imm(rs1), 带 sym 时是 rd, %lo(sym)(rs1)
+  LW,
+  // rs2, imm(rs1), 带 sym 时是 rs2, %lo(sym)(rs1)
+  SW,
+  // rs1, rs2, target
+  BEQ, BNE, BLT, BGE,
+  // rs1, target
+  BEQZ, BNEZ,
+  // target
+  J,
+  // sym, 用到 imm 个参数寄存器
+  CALL,
+  // imm 为 1 时返回 a0
+  RET,
+  // sym, 用到 imm 个参数寄存器; 尾调用, 先拆掉栈帧再跳过去, 由被调用者直接返回到调用者
+  TAIL,
+  // 以下是向量指令 (RVV 1.0), 元素都是 32 位, LMUL 为 1; vd, vs1, vs2 是向量寄存器
+  // rd, rs1: vsetvli rd, rs1, e32, m1; imm 为 1 时尾部元素保持不变 (tu, mu), 否则为 ta, ma.
+  // rs1 为 zero (rd 不能是 zero) 时 vl 取最大值
+  VSETVLI,
+  // vd
+  VID,
+  // vd, rs1
+  VMV_V_X, VMV_S_X,
+  // rd, vs2
+  VMV_X_S,
+  // vd, vs2, rs1
+  VADD_VX,
+  // vd, vs2, vs1; vsub 和 vdiv 是 vs2 减 (除以) vs1, vredsum 把 vs2 的所有元素加到 vs1[0] 上写进 vd[0]
+  VADD_VV, VSUB_VV, VMUL_VV, VDIV_VV, VREM_VV, VREDSUM_VS,
+};
+
+// 机器指令
+// 唯一的目的寄存器是 rd, 读 rs1 和 rs2; call 另外隐式读参数寄存器, 写所有调用者保存的寄存器
+struct minst_t {
+  mop_t op;
+  int rd = NOREG;
+  int rs1 = NOREG;
+  int rs2 = NOREG;
+  int imm = 0;
+  // 访存的基址是 sp 并且 slot >= 0 时, 实际偏移是栈帧对象 slot 的偏移加上 imm, 在栈帧布局时确定
+  int slot = -1;
+  // 跳转目标的基本块编号
+  int target = -1;
+  // 被调用的函数或访问的全局变量
+  std::string sym;
+  // 向量指令的向量寄存器
+  int vd = -1;
+  int vs1 = -1;
+  int vs2 = -1;
+};
+
+// 机器基本块
+struct mblock_t {
+  std::string label;
+  std::vector<minst_t> insts;
+};
+
+// 栈帧对象: 局部变量, 溢出的虚拟寄存器, 以及通过栈传入的参数
+struct mframe_t {
+  int size = 4;
+  // 栈帧布局之后相对 sp 的偏移
+  int offset = 0;
+  // 第 arg 个参数 (arg >= 8) 由调用者放在它自己的栈帧里, 不占本函数的栈帧
+  int arg = -1;
+};
+
+// 机器函数
+struct mfunc_t {
+  std::string name;
+  std::vector<mblock_t> blocks;
+  std::vector<mframe_t> frame;
+  // 下一个可用的虚拟寄存器
+  int vregs = VREG;
+  // 函数里有 call, 需要保存 ra
+  bool has_call = false;
+  // 调用其他函数时通过栈传递参数所需的字节数, 放在栈帧底部
+  int out_args = 0;
+  // 栈帧总大小, 栈帧布局之后有效
+  int frame_size = 0;
+
+  int New_reg() { return vregs++; }
+
+  int New_slot(int size){
+    frame.push_back(mframe_t());
+    frame.back().size = size;
+    return frame.size() - 1;
+  }
+};
+
+// 栈槽的位集合
+struct slots_t {
+  std::vector<unsigned long long> bits;
+
+  explicit slots_t(size_t n = 0) : bits((n + 63) / 64, 0) {}
+  bool Has(int s) const { return bits[s / 64] >> (s % 64) & 1; }
+  void Add(int s) { bits[s / 64] |= 1ULL << (s % 64); }
+  void Remove(int s) { bits[s / 64] &= ~(1ULL << (s % 64)); }
+};
+
+inline minst_t Minst(mop_t op, int rd = NOREG, int rs1 = NOREG, int rs2 = NOREG, int imm = 0){
+  minst_t inst;
+  inst.op = op;
+  inst.rd = rd;
+  inst.rs1 = rs1;
+  inst.rs2 = rs2;
+  inst.imm = imm;
+  return inst;
+}
+
+// 读写栈帧对象 slot
+inline minst_t Load_slot(int rd, int slot){
+  minst_t inst = Minst(mop_t::LW, rd, SP);
+  inst.slot = slot;
+  return inst;
+}
+
+inline minst_t Store_slot(int rs, int slot){
+  minst_t inst = Minst(mop_t::SW, NOREG, SP, rs);
+  inst.slot = slot;
+  return inst;
+}
+
+inline bool Is_vreg(int reg) { return reg >= VREG; }
+
+inline bool Is_branch(mop_t op){
+  return op == mop_t::BEQ || op == mop_t::BNE || op == mop_t::BLT || op == mop_t::BGE ||
+         op == mop_t::BEQZ || op == mop_t::BNEZ;
+}
+
+// 离开函数的指令, 前面要插入结语
+inline bool Is_exit(mop_t op){
+  return op == mop_t::RET || op == mop_t::TAIL;
+}
+
+// 向量指令会读写 vl 和向量寄存器, 这些状态不在寄存器的活跃性里, 不能删除或者调换顺序
+inline bool Is_vector(mop_t op){
+  return op >= mop_t::VSETVLI;
+}
+
+// 基本块的结束指令
+inline bool Is_terminator(mop_t op){
+  return Is_branch(op) || op == mop_t::J || Is_exit(op);
+}
+
+inline bool Fits_imm12(int imm){
+  return imm >= -2048 && imm < 2048;
+}
+
+// 调用者保存的寄存器: ra, t0~t6, a0~a7
+const unsigned CALLER_SAVED = 1u << RA | 0x7u << T0 | 0xffu << A0 | 0xfu << 28;
+
+// 物理寄存器的位集合
+inline unsigned Reg_bit(int reg){
+  return reg > ZERO && reg < VREG ? 1u << reg : 0;
+}
+
+// 指令读的物理寄存器
+inline unsigned Use_mask(const minst_t &inst){
+  unsigned mask = Reg_bit(inst.rs1) | Reg_bit(inst.rs2);
+  if (inst.op == mop_t::CALL) mask |= ((1u << inst.imm) - 1) << A0 | Reg_bit(SP);
+  if (inst.op == mop_t::TAIL) mask |= ((1u << inst.imm) - 1) << A0 | Reg_bit(RA) | Reg_bit(SP);
+  if (inst.op == mop_t::RET) mask |= (inst.imm ? Reg_bit(A0) : 0) | Reg_bit(RA) | Reg_bit(SP);
+  return mask;
+}
+
+// 指令写的物理寄存器
+inline unsigned Def_mask(const minst_t &inst){
+  if (inst.op == mop_t::CALL) return CALLER_SAVED;
+  return Reg_bit(inst.rd);
+}
+
+// 块的后继, 最后一条指令不是 j/ret/tail 时还会落入下一块
+inline std::vector<int> Succs(const mfunc_t &func, int i){
+  std::vector<int> succ;
+  auto &insts = func.blocks[i].insts;
+  for (auto &inst : insts){
+    if (inst.target >= 0) succ.push_back(inst.target);
+  }
+  bool falls = insts.empty() || (insts.back().op != mop_t::J && !Is_exit(insts.back().op));
+  if (falls && i + 1 < (int)func.blocks.size()) succ.push_back(i + 1);
+  return succ;
+}
@@ -0,0 +1,488 @@
+#include <algorithm>
+#include <climits>
+#include <map>
+#include <utility>
+#include <vector>
+#include "mir.hpp"
+
+extern void slot_liveness(const mfunc_t &func, std::vector<slots_t> &live_in, std::vector<slots_t> &live_out);
+
+// 窥孔优化
+// 在寄存器分配之后, 栈帧布局之前对机器指令做局部改写, 反复进行直到没有变化:
+//   控制流: 跳转穿透只含 j 的块, 删除不可达的块, 删除跳到下一块的 j, 必要时把分支取反, 合并顺序相接的块
+//   向前扫描: 常量和复制传播, 栈槽的存取转发, li 和运算合并成立即数形式, 零常量改用 x0;
+//     只有一个前驱的块接着前驱出口处的事实继续扫描, 转发可以跨过 if 的分支
+//   块内向后扫描: 根据寄存器活跃性删除结果不再使用的指令, 根据栈槽活跃性删除之后不会被读到的 sw
+
+static mop_t Invert(mop_t op){
+  switch (op){
+    case mop_t::BEQ: return mop_t::BNE;
+    case mop_t::BNE: return mop_t::BEQ;
+    case mop_t::BLT: return mop_t::BGE;
+    case mop_t::BGE: return mop_t::BLT;
+    case mop_t::BEQZ: return mop_t::BNEZ;
+    default: return mop_t::BEQZ;
+  }
+}
+
+// 控制流上的化简
+static bool Simplify_cfg(mfunc_t &func){
+  bool changed = false;
+  int n = func.blocks.size();
+
+  // 跳到只含 j 的块时直接跳到最终目标
+  for (auto &bb : func.blocks){
+    for (auto &inst : bb.insts){
+      if (inst.target < 0) continue;
+      for (int step = 0; step < n; ++step){
+        auto &dest = func.blocks[inst.target].insts;
+        if (dest.size() != 1 || dest[0].op != mop_t::J || dest[0].target == inst.target) break;
+        inst.target = dest[0].target;
+        changed = true;
+      }
+    }
+    // 分支的两个方向相同
+    size_t k = bb.insts.size();
+    if (k >= 2 && Is_branch(bb.insts[k - 2].op) && bb.insts[k - 1].op == mop_t::J &&
+        bb.insts[k - 2].target == bb.insts[k - 1].target){
+      bb.insts.erase(bb.insts.end() - 2);
+      changed = true;
+    }
+  }
+
+  // 删除不可达的块
+  std::vector<int> id(n, -1);
+  std::vector<int> work = {0};
+  id[0] = 0;
+  while (!work.empty()){
+    int i = work.back();
+    work.pop_back();
+    for (int s : Succs(func, i)){
+      if (id[s] < 0){
+        id[s] = 0;
+        work.push_back(s);
+      }
+    }
+  }
+  std::vector<mblock_t> blocks;
+  for (int i = 0; i < n; ++i){
+    if (id[i] < 0) continue;
+    id[i] = blocks.size();
+    blocks.push_back(std::move(func.blocks[i]));
+  }
+  if ((int)blocks.size() != n) changed = true;
+  for (auto &bb : blocks){
+    for (auto &inst : bb.insts){
+      if (inst.target >= 0) inst.target = id[inst.target];
+    }
+  }
+  func.blocks.swap(blocks);
+
+  // 删除跳到下一块的 j; 分支跳到下一块时取反, 省掉后面的 j
+  n = func.blocks.size();
+  for (int i = 0; i < n; ++i){
+    auto &insts = func.blocks[i].insts;
+    size_t k = insts.size();
+    if (k == 0 || insts[k - 1].op != mop_t::J) continue;
+    if (insts[k - 1].target == i + 1){
+      insts.pop_back();
+      changed = true;
+    }
+    else if (k >= 2 && Is_branch(insts[k - 2].op) && insts[k - 2].target == i + 1){
+      insts[k - 2].op = Invert(insts[k - 2].op);
+      insts[k - 2].target = insts[k - 1].target;
+      insts.pop_back();
+      changed = true;
+    }
+  }
+
+  // 落入下一块, 而下一块没有别的前驱时把两块合并
+  std::vector<int> refs(n, 0);
+  for (auto &bb : func.blocks){
+    for (auto &inst : bb.insts){
+      if (inst.target >= 0) refs[inst.target]++;
+    }
+  }
+  blocks.clear();
+  for (int i = 0; i < n; ++i){
+    auto &insts = func.blocks[i].insts;
+    bool falls = !blocks.empty() && (blocks.back().insts.empty() || !Is_terminator(blocks.back().insts.back().op));
+    if (refs[i] == 0 && falls){
+      auto &prev = blocks.back().insts;
+      prev.insert(prev.end(), insts.begin(), insts.end());
+      id[i] = blocks.size() - 1;
+      changed = true;
+    }
+    else{
+      id[i] = blocks.size();
+      blocks.push_back(std::move(func.blocks[i]));
+    }
+  }
+  for (auto &bb : blocks){
+    for (auto &inst : bb.insts){
+      if (inst.target >= 0) inst.target = id[inst.target];
+    }
+  }
+  func.blocks.swap(blocks);
+  return changed;
+}
+
+// 块内向前扫描时已知的事实
+struct facts_t {
+  bool is_const[32];
+  int value[32];
+  // 与该寄存器值相同的另一个寄存器
+  int copy[32];
+  // 寄存器中是哪个全局变量地址的高 20 位
+  std::string hi[32];
+  // 栈槽 (slot, imm) 的当前值所在的寄存器, 以及每个寄存器记在哪些栈槽上
+  std::map<std::pair<int, int>, int> mem;
+  std::vector<std::pair<int, int>> held[32];
+
+  facts_t(){
+    for (int r = 0; r < 32; ++r){
+      is_const[r] = r == ZERO;
+      value[r] = 0;
+      copy[r] = NOREG;
+    }
+  }
+
+  // 寄存器 reg 被改写
+  void Kill(int reg){
+    is_const[reg] = false;
+    copy[reg] = NOREG;
+    hi[reg].clear();
+    for (int r = 0; r < 32; ++r){
+      if (copy[r] == reg) copy[r] = NOREG;
+    }
+    for (auto &key : held[reg]){
+      auto it = mem.find(key);
+      if (it != mem.end() && it->second == reg) mem.erase(it);
+    }
+    held[reg].clear();
+  }
+
+  void Remember(std::pair<int, int> key, int reg){
+    mem[key] = reg;
+    held[reg].push_back(key);
+  }
+
+  void Forget(){
+    mem.clear();
+    for (auto &keys : held) keys.clear();
+  }
+};
+
+// 交换律
+static bool Commutes(mop_t op){
+  return op == mop_t::ADD || op == mop_t::MUL || op == mop_t::AND || op == mop_t::OR || op == mop_t::XOR;
+}
+
+// 第二个操作数是常量时对应的立即数形式
+static bool Imm_form(mop_t op, mop_t &iop){
+  switch (op){
+    case mop_t::ADD: iop = mop_t::ADDI; return true;
+    case mop_t::AND: iop = mop_t::ANDI; return true;
+    case mop_t::OR: iop = mop_t::ORI; return true;
+    case mop_t::XOR: iop = mop_t::XORI; return true;
+    case mop_t::SLT: iop = mop_t::SLTI; return true;
+    case mop_t::SLL: iop = mop_t::SLLI; return true;
+    case mop_t::SRL: iop = mop_t::SRLI; return true;
+    case mop_t::SRA: iop = mop_t::SRAI; return true;
+    default: return false;
+  }
+}
+
+// 两个常量的运算, 除以 0 时不折叠
+static bool Fold(mop_t op, int x, int y, int &res){
+  unsigned ux = x, uy = y;
+  switch (op){
+    case mop_t::ADD: case mop_t::ADDI: res = ux + uy; return true;
+    case mop_t::SUB: res = ux - uy; return true;
+    case mop_t::MUL: res = ux * uy; return true;
+    case mop_t::DIV:
+      if (y == 0 || (x == INT_MIN && y == -1)) return false;
+      res = x / y;
+      return true;
+    case mop_t::REM:
+      if (y == 0 || (x == INT_MIN && y == -1)) return false;
+      res = x % y;
+      return true;
+    case mop_t::AND: case mop_t::ANDI: res = x & y; return true;
+    case mop_t::OR: case mop_t::ORI: res = x | y; return true;
+    case mop_t::XOR: case mop_t::XORI: res = x ^ y; return true;
+    case mop_t::SLL: case mop_t::SLLI: res = ux << (y & 31); return true;
+    case mop_t::SRL: case mop_t::SRLI: res = ux >> (y & 31); return true;
+    case mop_t::SRA: case mop_t::SRAI: res = x >> (y & 31); return true;
+    case mop_t::SLT: case mop_t::SLTI: res = x < y; return true;
+    default: return false;
+  }
+}
+
+static int Log2(int x){
+  if (x <= 0 || (x & (x - 1))) return -1;
+  int k = 0;
+  while ((1 << k) != x) ++k;
+  return k;
+}
+
+// 根据已知的常量化简一条指令, 返回 false 表示删除该指令
+static bool Simplify_inst(minst_t &inst, facts_t &f){
+  auto rd = inst.rd;
+  auto cst = [&](int reg){ return reg >= 0 && f.is_const[reg]; };
+  switch (inst.op){
+    case mop_t::MV:
+      if (cst(inst.rs1)) inst = Minst(mop_t::LI, rd, NOREG, NOREG, f.value[inst.rs1]);
+      else if (rd == inst.rs1) return false;
+      break;
+    case mop_t::SEQZ: case mop_t::SNEZ:
+      if (cst(inst.rs1)){
+        bool zero = f.value[inst.rs1] == 0;
+        inst = Minst(mop_t::LI, rd, NOREG, NOREG, inst.op == mop_t::SEQZ ? zero : !zero);
+      }
+      break;
+    case mop_t::ADD: case mop_t::SUB: case mop_t::MUL: case mop_t::DIV: case mop_t::REM:
+    case mop_t::AND: case mop_t::OR: case mop_t::XOR: case mop_t::SLL: case mop_t::SRL:
+    case mop_t::SRA: case mop_t::SLT: {
+      int res;
+      if (cst(inst.rs1) && cst(inst.rs2) && Fold(inst.op, f.value[inst.rs1], f.value[inst.rs2], res)){
+        inst = Minst(mop_t::LI, rd, NOREG, NOREG, res);
+        break;
+      }
+      if (cst(inst.rs1) && !cst(inst.rs2) && Commutes(inst.op)) std::swap(inst.rs1, inst.rs2);
+      if (!cst(inst.rs2)) break;
+      int c = f.value[inst.rs2];
+      mop_t iop;
+      if (inst.op == mop_t::SUB && c != INT_MIN && Fits_imm12(-c)){
+        inst = Minst(mop_t::ADDI, rd, inst.rs1, NOREG, -c);
+      }
+      else if (inst.op == mop_t::MUL && Log2(c) >= 0){
+        inst = Minst(mop_t::SLLI, rd, inst.rs1, NOREG, Log2(c));
+      }
+      else if (Imm_form(inst.op, iop) && Fits_imm12(c)){
+        inst = Minst(iop, rd, inst.rs1, NOREG, c);
+      }
+      if (inst.op == mop_t::SLLI || inst.op == mop_t::SRLI || inst.op == mop_t::SRAI) inst.imm &= 31;
+      if ((inst.op == mop_t::ADDI || inst.op == mop_t::SLLI || inst.op == mop_t::ORI ||
+           inst.op == mop_t::XORI || inst.op == mop_t::SRLI || inst.op == mop_t::SRAI) && inst.imm == 0){
+        inst = Minst(mop_t::MV, rd, inst.rs1);
+        return Simplify_inst(inst, f);
+      }
+      break;
+    }
+    case mop_t::ADDI: case mop_t::ANDI: case mop_t::ORI: case mop_t::XORI: case mop_t::SLLI:
+    case mop_t::SRLI: case mop_t::SRAI: case mop_t::SLTI: {
+      int res;
+      if (cst(inst.rs1) && Fold(inst.op, f.value[inst.rs1], inst.imm, res)){
+        inst = Minst(mop_t::LI, rd, NOREG, NOREG, res);
+      }
+      break;
+    }
+    case mop_t::BEQZ: case mop_t::BNEZ:
+      if (cst(inst.rs1)){
+        bool zero = f.value[inst.rs1] == 0;
+        if (zero != (inst.op == mop_t::BEQZ)) return false;
+        int target = inst.target;
+        inst = Minst(mop_t::J);
+        inst.target = target;
+      }
+      break;
+    default:
+      break;
+  }
+  return true;
+}
+
+// 向前扫描一个块, f 是入口处已知的事实, 扫描完是出口处的
+static bool Forward(mblock_t &bb, facts_t &f){
+  bool changed = false;
+  std::vector<minst_t> insts;
+  insts.reserve(bb.insts.size());
+  for (auto inst : bb.insts){
+    minst_t old = inst;
+    // 复制传播, 零常量换成 x0
+    for (int *rs : {&inst.rs1, &inst.rs2}){
+      if (*rs < 0) continue;
+      if (f.copy[*rs] != NOREG) *rs = f.copy[*rs];
+      // vsetvli 的 rs1 为 zero 表示取最大的 vl, 不能替换
+      if (f.is_const[*rs] && f.value[*rs] == 0 && inst.op != mop_t::VSETVLI) *rs = ZERO;
+    }
+
+    // 栈槽的存取转发
+    auto key = std::make_pair(inst.slot, inst.imm);
+    if (inst.op == mop_t::LW && inst.slot >= 0 && f.mem.count(key)){
+      int reg = f.mem[key];
+      if (reg == inst.rd){
+        changed = true;
+        continue;
+      }
+      inst = Minst(mop_t::MV, inst.rd, reg);
+    }
+    if (inst.op == mop_t::SW && inst.slot >= 0 && f.mem.count(key) && f.mem[key] == inst.rs2){
+      changed = true;
+      continue;
+    }
+
+    // 同一个全局变量的 lui 只做一次
+    if (inst.op == mop_t::LUI){
+      for (int r = 1; r < 32; ++r){
+        if (r != inst.rd && f.hi[r] == inst.sym){
+          inst = Minst(mop_t::MV, inst.rd, r);
+          break;
+        }
+      }
+    }
+
+    bool keep = Simplify_inst(inst, f);
+    if (!keep || inst.op != old.op || inst.rd != old.rd || inst.rs1 != old.rs1 ||
+        inst.rs2 != old.rs2 || inst.imm != old.imm){
+      changed = true;
+    }
+    if (!keep) continue;
+
+    // 更新已知的事实
+    unsigned defs = Def_mask(inst);
+    for (int r = 1; r < 32; ++r){
+      if (defs >> r & 1) f.Kill(r);
+    }
+    if (defs & Reg_bit(SP)) f.Forget();
+    switch (inst.op){
+      case mop_t::LI:
+        f.is_const[inst.rd] = true;
+        f.value[inst.rd] = inst.imm;
+        break;
+      case mop_t::MV:
+        if (inst.rd != inst.rs1) f.copy[inst.rd] = inst.rs1;
+        break;
+      case mop_t::LUI:
+        f.hi[inst.rd] = inst.sym;
+        break;
+      case mop_t::LW:
+        if (inst.slot >= 0 && inst.rd > ZERO) f.Remember(key, inst.rd);
+        break;
+      case mop_t::SW:
+        if (inst.slot >= 0) f.Remember(key, inst.rs2);
+        else if (inst.rs1 != SP && inst.sym.empty()) f.Forget();
+        break;
+      case mop_t::CALL:
+        f.Forget();
+        break;
+      default:
+        break;
+    }
+    insts.push_back(inst);
+    // 条件跳转折叠成 j 之后, 块中剩下的指令 (原来结尾的 j) 不会再执行, 一并删掉
+    if (inst.op == mop_t::J) break;
+  }
+  bb.insts.swap(insts);
+  return changed;
+}
+
+// 每个块唯一的前驱, 没有或者有多个前驱时为 -1; 入口块总是 -1
+static std::vector<int> Single_preds(const mfunc_t &func){
+  int n = func.blocks.size();
+  std::vector<int> pred(n, -1), count(n, 0);
+  if (n > 0) count[0] = 1;
+  for (int i = 0; i < n; ++i){
+    auto succ = Succs(func, i);
+    std::sort(succ.begin(), succ.end());
+    succ.erase(std::unique(succ.begin(), succ.end()), succ.end());
+    for (int s : succ){
+      count[s]++;
+      pred[s] = i;
+    }
+  }
+  for (int i = 0; i < n; ++i){
+    if (count[i] != 1) pred[i] = -1;
+  }
+  return pred;
+}
+
+// 按块的顺序向前扫描, 前驱在前面时从它出口处的事实开始
+static bool Forward_all(mfunc_t &func){
+  bool changed = false;
+  auto pred = Single_preds(func);
+  std::vector<facts_t> exit(func.blocks.size());
+  for (size_t i = 0; i < func.blocks.size(); ++i){
+    facts_t f = pred[i] >= 0 && pred[i] < (int)i ? exit[pred[i]] : facts_t();
+    changed |= Forward(func.blocks[i], f);
+    exit[i] = f;
+  }
+  return changed;
+}
+
+// 根据寄存器活跃性删除无用的指令, 并删除之后不会被读到的栈槽上的 sw
+// 栈帧对象的地址不会被取走, 只有带 slot 的 lw 会读它; 数组等更大的对象和栈上传入的参数不做处理
+static bool Backward(mfunc_t &func){
+  int n = func.blocks.size();
+  std::vector<unsigned> live_in(n, 0), live_out(n, 0);
+  bool again = true;
+  while (again){
+    again = false;
+    for (int i = n - 1; i >= 0; --i){
+      unsigned out = 0;
+      for (int s : Succs(func, i)) out |= live_in[s];
+      unsigned live = out;
+      auto &insts = func.blocks[i].insts;
+      for (auto it = insts.rbegin(); it != insts.rend(); ++it){
+        live = (live & ~Def_mask(*it)) | Use_mask(*it);
+      }
+      if (out != live_out[i] || live != live_in[i]){
+        live_out[i] = out;
+        live_in[i] = live;
+        again = true;
+      }
+    }
+  }
+
+  std::vector<slots_t> slot_in, slot_out;
+  slot_liveness(func, slot_in, slot_out);
+  auto scalar = [&](int s){ return func.frame[s].arg < 0 && func.frame[s].size == 4; };
+
+  bool changed = false;
+  for (int i = 0; i < n; ++i){
+    auto &insts = func.blocks[i].insts;
+    unsigned live = live_out[i];
+    slots_t &slots = slot_out[i];
+    std::vector<minst_t> kept;
+    kept.reserve(insts.size());
+    // 紧随其后的那条保留下来的指令执行之后的活跃寄存器
+    unsigned live_next = live;
+    for (auto it = insts.rbegin(); it != insts.rend(); ++it){
+      auto inst = *it;
+      bool pure = inst.op != mop_t::SW && inst.op != mop_t::CALL && !Is_terminator(inst.op) && !Is_vector(inst.op);
+      bool dead = pure && inst.rd != SP && !(Def_mask(inst) & live);
+      if (inst.op == mop_t::SW && inst.slot >= 0 && scalar(inst.slot) && !slots.Has(inst.slot)) dead = true;
+      if (dead){
+        changed = true;
+        continue;
+      }
+      // op t, ...; mv r, t 并且 t 之后不再使用时, 直接算到 r 里
+      if (pure && inst.rd > ZERO && !kept.empty()){
+        auto &mv = kept.back();
+        if (mv.op == mop_t::MV && mv.rs1 == inst.rd && mv.rd != SP && !(live_next & Reg_bit(inst.rd))){
+          inst.rd = mv.rd;
+          live = live_next;
+          kept.pop_back();
+          changed = true;
+        }
+      }
+      live_next = live;
+      live = (live & ~Def_mask(inst)) | Use_mask(inst);
+      if (inst.slot >= 0 && inst.op == mop_t::SW) slots.Remove(inst.slot);
+      else if (inst.slot >= 0) slots.Add(inst.slot);
+      kept.push_back(inst);
+    }
+    insts.assign(kept.rbegin(), kept.rend());
+  }
+  return changed;
+}
+
+void peephole(mfunc_t &func){
+  for (int round = 0; round < 16; ++round){
+    bool changed = Simplify_cfg(func);
+    changed |= Forward_all(func);
+    changed |= Backward(func);
+    if (!changed) break;
+  }
+}
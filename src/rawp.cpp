@@ -3,448 +3,389 @@
 #include <iostream>
 #include <cstdlib>
 #include <memory>
-#include <stack>
 #include <map>
+#include <set>
 #include <string>
 #include <cstring>
-#include "sym.hpp"
+#include <cstdarg>
+#include <functional>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
 #include "koopa.h"
+#include "effect.hpp"
+#include "alias.hpp"
+#include "mir.hpp"
+#include "writer.hpp"
 
-int used = 0;
-int sum_stack;
-std::stack<num_t> value_st;
-std::map<std::string, sym_t> value_ma;
+// 局部值编号的键: load 是 (地址, 空), call 是 (被调用的函数, 实参);
+// 实参是常数时记 (0, 值), 否则记 (1, 所在的虚拟寄存器)
+typedef std::pair<const void *, std::vector<std::pair<int, int>>> vn_key_t;
 
-// 访问 integer
-void Visit_integer(const koopa_raw_integer_t &integer){
-  int value = integer.value;
-  std::cout << value;
+struct vn_entry_t {
+  koopa_raw_value_t value;
+  bool load;
+  // 结果和全局变量 (或指针指向的内存) 有关, 写内存后失效
+  bool global;
+};
+
+// 循环里提升到栈槽的全局变量
+struct promote_t {
+  koopa_raw_value_t global;
+  int slot;
+  // 循环里写过, 离开循环时要写回
+  bool dirty;
+};
+
+// 向量化的循环: 每次迭代 iv 加 1 直到等于 bound, 循环体只把 iv 和不变量的表达式累加到 accs 上
+struct vloop_t {
+  koopa_raw_basic_block_t head, exit;
+  // 归纳变量, 以及循环条件里的上界 (整数或者不变量的 load)
+  koopa_raw_value_t iv, bound;
+  // 累加变量, 以及每次迭代加上的项和它的符号
+  std::vector<std::pair<koopa_raw_value_t, std::vector<std::pair<koopa_raw_value_t, int>>>> accs;
+  // 各项的所有子表达式, 按后序排列
+  std::vector<koopa_raw_value_t> nodes;
+};
+
+// 单个函数的代码生成上下文
+// 函数之间互不依赖, 每个函数在自己的上下文里生成代码, 输出先写入私有缓冲区
+struct func_ctx_t{
+  mfunc_t func;
+  // 正在生成指令的基本块
+  int cur = 0;
+  // Koopa 值所在的虚拟寄存器
+  std::map<koopa_raw_value_t, int> value_reg;
+  // alloc 对应的栈帧对象
+  std::map<koopa_raw_value_t, int> value_slot;
+  std::map<koopa_raw_basic_block_t, int> block_id;
+  // 正在生成的函数, 以及它的参数所在的虚拟寄存器
+  koopa_raw_function_t self = nullptr;
+  std::vector<int> params;
+  // 当前基本块里可以复用的 load 和 call, 以及和前面的 load 值相同的 load
+  std::map<vn_key_t, vn_entry_t> avail;
+  std::map<koopa_raw_value_t, koopa_raw_value_t> same;
+  // 要外提到循环前置块末尾的指令, 以及所有外提了的指令
+  std::map<koopa_raw_basic_block_t, std::vector<koopa_raw_value_t>> hoist;
+  std::set<koopa_raw_value_t> hoisted;
+  // 每个基本块里提升到栈槽的全局变量, 以及要在前置块末尾装入栈槽的全局变量
+  std::map<koopa_raw_basic_block_t, std::vector<promote_t>> promoted;
+  std::map<koopa_raw_basic_block_t, std::vector<promote_t>> promote_load;
+  koopa_raw_basic_block_t cur_bb = nullptr;
+  // 向量化的循环, 按前置块
+  std::map<koopa_raw_basic_block_t, vloop_t> vector;
+  std::string out;
+};
+
+// 当前线程正在处理的上下文
+thread_local func_ctx_t *ctx;
+
+// 函数级缓存, 见 cache.cpp
+extern unsigned long long Hash_bytes(const void *data, size_t len, unsigned long long h);
+extern unsigned long long build_id();
+extern bool cache_enabled();
+extern bool cache_load(unsigned long long key, std::string &data);
+extern void cache_save(unsigned long long key, const std::string &data);
+
+// 机器指令的后续处理, 见 mir.cpp
+extern void alloc_regs(mfunc_t &func);
+extern void peephole(mfunc_t &func);
+extern void layout_frame(mfunc_t &func);
+extern void schedule(mfunc_t &func);
+extern const char *core_name();
+extern void emit_func(const mfunc_t &func, std::string &out);
+
+// 记忆化, 见 memo.cpp
+extern int memo_wrapper(mfunc_t &func, const std::string &body, const std::string &table, int nargs);
+
+// 优化级别, 由命令行的 -O<n> 指定; 3 以上打开记忆化
+int opt_level = 0;
+// 目标支持向量扩展 (RVV 1.0), 由命令行的 -rvv 打开, 之后对简单的计数循环做向量化
+bool target_rvv = false;
+
+// 每个函数的缓存键, 由该函数的 Koopa IR 文本算出
+// 常量已经被前端折叠进 IR, 所以 IR 文本不变时生成的汇编也不变
+std::map<std::string, unsigned long long> func_key;
+
+// 向当前上下文的缓冲区输出
+void emit(const char *fmt, ...){
+  va_list args;
+  va_start(args, fmt);
+  Format(ctx->out, fmt, args);
+  va_end(args);
+}
+
+// 向当前基本块追加一条机器指令
+void Append(const minst_t &inst){
+  ctx->func.blocks[ctx->cur].insts.push_back(inst);
+}
+
+// 类型占用的字节数
+int Type_size(koopa_raw_type_t ty){
+  switch (ty->tag){
+    case KOOPA_RTT_ARRAY:
+      return ty->data.array.len * Type_size(ty->data.array.base);
+    case KOOPA_RTT_UNIT:
+      return 0;
+    default:
+      return 4;
+  }
+}
+
+// 访问 integer, 用 li 装入新的虚拟寄存器
+int Visit_integer(const koopa_raw_integer_t &integer){
+  int reg = ctx->func.New_reg();
+  Append(Minst(mop_t::LI, reg, NOREG, NOREG, integer.value));
+  return reg;
+}
+
+// 值所在的虚拟寄存器, 第一次遇到时分配
+int Value_reg(koopa_raw_value_t value){
+  if (value->kind.tag == KOOPA_RVT_INTEGER) return Visit_integer(value->kind.data.integer);
+  auto it = ctx->value_reg.find(value);
+  if (it != ctx->value_reg.end()) return it->second;
+  int reg = ctx->func.New_reg();
+  ctx->value_reg[value] = reg;
+  return reg;
 }
 
 // 访问 binary 指令
-void Visit_binary(const koopa_raw_binary_t &binary){
-  koopa_raw_value_t lhs = binary.lhs;
-  koopa_raw_value_t rhs = binary.rhs;
-  num_t tmpnum, tmpnum1, tmpnum2;
+void Visit_binary(const koopa_raw_binary_t &binary, koopa_raw_value_t value){
+  int lhs = Value_reg(binary.lhs);
+  int rhs = Value_reg(binary.rhs);
+  int rd = Value_reg(value);
+  int tmp;
   switch (binary.op){
     // Not equal to
     case KOOPA_RBO_NOT_EQ:
-      if (lhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t0, ");
-        Visit_integer(lhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum1 = value_st.top();
-        value_st.pop();
-        printf("  lw    t0, %d(sp)\n", tmpnum1.num_val);
-      }
-      if (rhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t1, ");
-        Visit_integer(rhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum2 = value_st.top();
-        value_st.pop();
-        printf("  lw    t1, %d(sp)\n", tmpnum2.num_val);
-      }
-      printf("  xor   t0, t0, t1\n");
-      printf("  snez  t0, t0\n");
-      printf("  sw    t0, %d(sp)\n", used);
-      tmpnum.num_val = used;
-      value_st.push(tmpnum);
-      used += 4;
+      tmp = ctx->func.New_reg();
+      Append(Minst(mop_t::XOR, tmp, lhs, rhs));
+      Append(Minst(mop_t::SNEZ, rd, tmp));
       break;
-    
     // Equal to
     case KOOPA_RBO_EQ:
-      if (lhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t0, ");
-        Visit_integer(lhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum1 = value_st.top();
-        value_st.pop();
-        printf("  lw    t0, %d(sp)\n", tmpnum1.num_val);
-      }
-      if (rhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t1, ");
-        Visit_integer(rhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum2 = value_st.top();
-        value_st.pop();
-        printf("  lw    t1, %d(sp)\n", tmpnum2.num_val);
-      }
-      printf("  xor   t0, t0, t1\n");
-      printf("  seqz  t0, t0\n");
-      printf("  sw    t0, %d(sp)\n", used);
-      tmpnum.num_val = used;
-      value_st.push(tmpnum);
-      used += 4;
+      tmp = ctx->func.New_reg();
+      Append(Minst(mop_t::XOR, tmp, lhs, rhs));
+      Append(Minst(mop_t::SEQZ, rd, tmp));
       break;
-    
     // Greater than
     case KOOPA_RBO_GT:
-      if (lhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t0, ");
-        Visit_integer(lhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum1 = value_st.top();
-        value_st.pop();
-        printf("  lw    t0, %d(sp)\n", tmpnum1.num_val);
-      }
-      if (rhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t1, ");
-        Visit_integer(rhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum2 = value_st.top();
-        value_st.pop();
-        printf("  lw    t1, %d(sp)\n", tmpnum2.num_val);
-      }
-      printf("  sgt   t0, t0, t1\n");
-      printf("  sw    t0, %d(sp)\n", used);
-      tmpnum.num_val = used;
-      value_st.push(tmpnum);
-      used += 4;
+      Append(Minst(mop_t::SLT, rd, rhs, lhs));
       break;
-    
     // Less than
     case KOOPA_RBO_LT:
-      if (lhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t0, ");
-        Visit_integer(lhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum1 = value_st.top();
-        value_st.pop();
-        printf("  lw    t0, %d(sp)\n", tmpnum1.num_val);
-      }
-      if (rhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t1, ");
-        Visit_integer(rhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum2 = value_st.top();
-        value_st.pop();
-        printf("  lw    t1, %d(sp)\n", tmpnum2.num_val);
-      }
-      printf("  slt   t0, t0, t1\n");
-      printf("  sw    t0, %d(sp)\n", used);
-      tmpnum.num_val = used;
-      value_st.push(tmpnum);
-      used += 4;
+      Append(Minst(mop_t::SLT, rd, lhs, rhs));
       break;
-    
     // Greater than or equal to
     case KOOPA_RBO_GE:
-      if (lhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t0, ");
-        Visit_integer(lhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum1 = value_st.top();
-        value_st.pop();
-        printf("  lw    t0, %d(sp)\n", tmpnum1.num_val);
-      }
-      if (rhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t1, ");
-        Visit_integer(rhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum2 = value_st.top();
-        value_st.pop();
-        printf("  lw    t1, %d(sp)\n", tmpnum2.num_val);
-      }
-      printf("  slt   t0, t0, t1\n");
-      printf("  seqz  t0, t0\n");
-      printf("  sw    t0, %d(sp)\n", used);
-      tmpnum.num_val = used;
-      value_st.push(tmpnum);
-      used += 4;
+      tmp = ctx->func.New_reg();
+      Append(Minst(mop_t::SLT, tmp, lhs, rhs));
+      Append(Minst(mop_t::SEQZ, rd, tmp));
       break;
-    
     // Less than or equal to
     case KOOPA_RBO_LE:
-      if (lhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t0, ");
-        Visit_integer(lhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum1 = value_st.top();
-        value_st.pop();
-        printf("  lw    t0, %d(sp)\n", tmpnum1.num_val);
-      }
-      if (rhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t1, ");
-        Visit_integer(rhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum2 = value_st.top();
-        value_st.pop();
-        printf("  lw    t1, %d(sp)\n", tmpnum2.num_val);
-      }
-      printf("  sgt   t0, t0, t1\n");
-      printf("  seqz  t0, t0\n");
-      printf("  sw    t0, %d(sp)\n", used);
-      tmpnum.num_val = used;
-      value_st.push(tmpnum);
-      used += 4;
+      tmp = ctx->func.New_reg();
+      Append(Minst(mop_t::SLT, tmp, rhs, lhs));
+      Append(Minst(mop_t::SEQZ, rd, tmp));
       break;
-    
     // Addition
     case KOOPA_RBO_ADD:
-      if (lhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t0, ");
-        Visit_integer(lhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum1 = value_st.top();
-        value_st.pop();
-        printf("  lw    t0, %d(sp)\n", tmpnum1.num_val);
-      }
-      if (rhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t1, ");
-        Visit_integer(rhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum2 = value_st.top();
-        value_st.pop();
-        printf("  lw    t1, %d(sp)\n", tmpnum2.num_val);
-      }
-      printf("  add   t0, t0, t1\n");
-      printf("  sw    t0, %d(sp)\n", used);
-      tmpnum.num_val = used;
-      value_st.push(tmpnum);
-      used += 4;
+      Append(Minst(mop_t::ADD, rd, lhs, rhs));
       break;
-    
     // Subtraction
     case KOOPA_RBO_SUB:
-      if (lhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t0, ");
-        Visit_integer(lhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum1 = value_st.top();
-        value_st.pop();
-        printf("  lw    t0, %d(sp)\n", tmpnum1.num_val);
-      }
-      if (rhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t1, ");
-        Visit_integer(rhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum2 = value_st.top();
-        value_st.pop();
-        printf("  lw    t1, %d(sp)\n", tmpnum2.num_val);
-      }
-      printf("  sub   t0, t0, t1\n");
-      printf("  sw    t0, %d(sp)\n", used);
-      tmpnum.num_val = used;
-      value_st.push(tmpnum);
-      used += 4;
+      Append(Minst(mop_t::SUB, rd, lhs, rhs));
       break;
-    
     // Multiplication
     case KOOPA_RBO_MUL:
-      if (lhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t0, ");
-        Visit_integer(lhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum1 = value_st.top();
-        value_st.pop();
-        printf("  lw    t0, %d(sp)\n", tmpnum1.num_val);
-      }
-      if (rhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t1, ");
-        Visit_integer(rhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum2 = value_st.top();
-        value_st.pop();
-        printf("  lw    t1, %d(sp)\n", tmpnum2.num_val);
-      }
-      printf("  mul   t0, t0, t1\n");
-      printf("  sw    t0, %d(sp)\n", used);
-      tmpnum.num_val = used;
-      value_st.push(tmpnum);
-      used += 4;
+      Append(Minst(mop_t::MUL, rd, lhs, rhs));
       break;
-    
     // Division
     case KOOPA_RBO_DIV:
-      if (lhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t0, ");
-        Visit_integer(lhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum1 = value_st.top();
-        value_st.pop();
-        printf("  lw    t0, %d(sp)\n", tmpnum1.num_val);
-      }
-      if (rhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t1, ");
-        Visit_integer(rhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum2 = value_st.top();
-        value_st.pop();
-        printf("  lw    t1, %d(sp)\n", tmpnum2.num_val);
-      }
-      printf("  div   t0, t0, t1\n");
-      printf("  sw    t0, %d(sp)\n", used);
-      tmpnum.num_val = used;
-      value_st.push(tmpnum);
-      used += 4;
+      Append(Minst(mop_t::DIV, rd, lhs, rhs));
       break;
-    
     // Modulo
     case KOOPA_RBO_MOD:
-      if (lhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t0, ");
-        Visit_integer(lhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum1 = value_st.top();
-        value_st.pop();
-        printf("  lw    t0, %d(sp)\n", tmpnum1.num_val);
-      }
-      if (rhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t1, ");
-        Visit_integer(rhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum2 = value_st.top();
-        value_st.pop();
-        printf("  lw    t1, %d(sp)\n", tmpnum2.num_val);
-      }
-      printf("  rem   t0, t0, t1\n");
-      printf("  sw    t0, %d(sp)\n", used);
-      tmpnum.num_val = used;
-      value_st.push(tmpnum);
-      used += 4;
+      Append(Minst(mop_t::REM, rd, lhs, rhs));
       break;
-    
     // Bitwise AND
     case KOOPA_RBO_AND:
-      if (lhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t0, ");
-        Visit_integer(lhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum1 = value_st.top();
-        value_st.pop();
-        printf("  lw    t0, %d(sp)\n", tmpnum1.num_val);
-      }
-      if (rhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t1, ");
-        Visit_integer(rhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum2 = value_st.top();
-        value_st.pop();
-        printf("  lw    t1, %d(sp)\n", tmpnum2.num_val);
-      }
-      printf("  and   t0, t0, t1\n");
-      printf("  sw    t0, %d(sp)\n", used);
-      tmpnum.num_val = used;
-      value_st.push(tmpnum);
-      used += 4;
+      Append(Minst(mop_t::AND, rd, lhs, rhs));
       break;
-    
     // Bitwise OR
     case KOOPA_RBO_OR:
-      if (lhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t0, ");
-        Visit_integer(lhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum1 = value_st.top();
-        value_st.pop();
-        printf("  lw    t0, %d(sp)\n", tmpnum1.num_val);
-      }
-      if (rhs->kind.tag == KOOPA_RVT_INTEGER){
-        printf("  li    t1, ");
-        Visit_integer(rhs->kind.data.integer);
-        std::cout << std::endl;
-      }
-      else{
-        tmpnum2 = value_st.top();
-        value_st.pop();
-        printf("  lw    t1, %d(sp)\n", tmpnum2.num_val);
-      }
-      printf("  or    t0, t0, t1\n");
-      printf("  sw    t0, %d(sp)\n", used);
-      tmpnum.num_val = used;
-      value_st.push(tmpnum);
-      used += 4;
-      break;  
+      Append(Minst(mop_t::OR, rd, lhs, rhs));
+      break;
+    // Bitwise XOR
+    case KOOPA_RBO_XOR:
+      Append(Minst(mop_t::XOR, rd, lhs, rhs));
+      break;
+    // Shift left logical
+    case KOOPA_RBO_SHL:
+      Append(Minst(mop_t::SLL, rd, lhs, rhs));
+      break;
+    // Shift right logical
+    case KOOPA_RBO_SHR:
+      Append(Minst(mop_t::SRL, rd, lhs, rhs));
+      break;
+    // Shift right arithmetic
+    case KOOPA_RBO_SAR:
+      Append(Minst(mop_t::SRA, rd, lhs, rhs));
+      break;
     default:
       assert(false);
       break;
   }
 }
 
-// 访问 alloc 指令
-void Visit_alloc(const koopa_raw_global_alloc_t &alloc){
-  // koopa_raw_value_t init = alloc.init;
-  // std::cout << "alloc tag = " << init->kind.tag << std::endl;
-  // switch (init->kind.tag){
-  //   case KOOPA_RVT_INTEGER:
-  //     break;
-  //   default:
-  //     break;
-  // }
+// 访问 alloc 指令, 在栈帧中分配一个对象
+void Visit_alloc(koopa_raw_value_t value){
+  ctx->value_slot[value] = ctx->func.New_slot(Type_size(value->ty->data.pointer.base));
+}
+
+// 全局变量的初值是否全为 0
+bool Is_zero_init(koopa_raw_value_t init){
+  switch (init->kind.tag){
+    case KOOPA_RVT_INTEGER:
+      return init->kind.data.integer.value == 0;
+    case KOOPA_RVT_ZERO_INIT:
+      return true;
+    case KOOPA_RVT_AGGREGATE: {
+      auto &elems = init->kind.data.aggregate.elems;
+      for (size_t i = 0; i < elems.len; ++i){
+        if (!Is_zero_init(reinterpret_cast<koopa_raw_value_t>(elems.buffer[i]))) return false;
+      }
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+// 输出全局变量的初值
+void Visit_init(koopa_raw_value_t init){
+  switch (init->kind.tag){
+    case KOOPA_RVT_INTEGER:
+      emit("  .word %d\n", init->kind.data.integer.value);
+      break;
+    case KOOPA_RVT_ZERO_INIT:
+      emit("  .zero %d\n", Type_size(init->ty));
+      break;
+    case KOOPA_RVT_AGGREGATE: {
+      auto &elems = init->kind.data.aggregate.elems;
+      for (size_t i = 0; i < elems.len; ++i) Visit_init(reinterpret_cast<koopa_raw_value_t>(elems.buffer[i]));
+      break;
+    }
+    default:
+      assert(false);
+      break;
+  }
 }
 
+// 不超过 8 字节的全局变量放进 .sdata/.sbss, 链接器松弛时可以把访问改写成相对 gp 的单条指令
+const int SMALL_DATA = 8;
+
 // 访问 global alloc 指令
-void Visit_global_alloc(const koopa_raw_global_alloc_t &global_alloc){
+// 有非零初值的放进 .data, 否则放进 .bss, 不占目标文件的空间
+void Visit_global_alloc(koopa_raw_value_t value){
+  const auto &global_alloc = value->kind.data.global_alloc;
+  int size = Type_size(value->ty->data.pointer.base);
+  bool zero = Is_zero_init(global_alloc.init);
+  bool small = size <= SMALL_DATA;
+  const char *section = zero ? (small ? ".sbss" : ".bss") : (small ? ".sdata" : ".data");
+  emit("  .section %s,\"aw\",%s\n", section, zero ? "@nobits" : "@progbits");
+  emit("  .align 2\n");
+  emit("%s:\n", value->name + 1);
+  if (zero) emit("  .zero %d\n", size);
+  else Visit_init(global_alloc.init);
+}
 
+// 访问全局变量: lui 装入地址的高 20 位, 访存指令里带上低 12 位
+// 比 la + lw 少一条指令, 链接器松弛后 lui 也可以省掉
+minst_t Global_access(mop_t op, int reg, koopa_raw_value_t global){
+  int hi = ctx->func.New_reg();
+  minst_t lui = Minst(mop_t::LUI, hi);
+  lui.sym = global->name + 1;
+  Append(lui);
+  minst_t inst = op == mop_t::LW ? Minst(mop_t::LW, reg, hi) : Minst(mop_t::SW, NOREG, hi, reg);
+  inst.sym = lui.sym;
+  return inst;
+}
+
+// 当前基本块里全局变量 global 提升到的栈槽, 没有提升时返回 -1
+int Promoted_slot(koopa_raw_value_t global){
+  auto it = ctx->promoted.find(ctx->cur_bb);
+  if (it == ctx->promoted.end()) return -1;
+  for (auto &p : it->second){
+    if (p.global == global) return p.slot;
+  }
+  return -1;
+}
+
+// 在函数末尾新建一个没有对应 Koopa 基本块的块
+int New_block(){
+  auto &blocks = ctx->func.blocks;
+  blocks.emplace_back();
+  blocks.back().label = ".L" + ctx->func.name + "_" + std::to_string(blocks.size() - 1);
+  return blocks.size() - 1;
+}
+
+// 从当前基本块跳到 to (为空时是返回) 之前, 把 to 里不再提升的全局变量写回
+void Write_back(koopa_raw_basic_block_t to){
+  auto from = ctx->promoted.find(ctx->cur_bb);
+  if (from == ctx->promoted.end()) return;
+  auto dest = to == nullptr ? ctx->promoted.end() : ctx->promoted.find(to);
+  for (auto &p : from->second){
+    if (!p.dirty) continue;
+    bool kept = false;
+    if (dest != ctx->promoted.end()){
+      for (auto &q : dest->second) kept |= q.global == p.global;
+    }
+    if (kept) continue;
+    int reg = ctx->func.New_reg();
+    Append(Load_slot(reg, p.slot));
+    Append(Global_access(mop_t::SW, reg, p.global));
+  }
+}
+
+// 跳转目标 to 的块编号; 离开循环时要写回全局变量, 在这条边上插入一个新块
+int Edge_target(koopa_raw_basic_block_t to){
+  int id = ctx->block_id[to];
+  auto &blocks = ctx->func.blocks;
+  size_t before = blocks[ctx->cur].insts.size();
+  Write_back(to);
+  if (blocks[ctx->cur].insts.size() == before) return id;
+  // 写回的指令移到新块里
+  int edge = New_block();
+  auto &insts = blocks[ctx->cur].insts;
+  blocks[edge].insts.assign(insts.begin() + before, insts.end());
+  insts.resize(before);
+  minst_t jump = Minst(mop_t::J);
+  jump.target = id;
+  blocks[edge].insts.push_back(jump);
+  return edge;
+}
+
+// 读写标量变量: 局部变量在栈帧里, 全局变量可能已经提升到栈槽
+void Load_var(int reg, koopa_raw_value_t var){
+  if (var->kind.tag == KOOPA_RVT_ALLOC) Append(Load_slot(reg, ctx->value_slot[var]));
+  else if (Promoted_slot(var) >= 0) Append(Load_slot(reg, Promoted_slot(var)));
+  else Append(Global_access(mop_t::LW, reg, var));
+}
+
+void Store_var(int reg, koopa_raw_value_t var){
+  if (var->kind.tag == KOOPA_RVT_ALLOC) Append(Store_slot(reg, ctx->value_slot[var]));
+  else if (Promoted_slot(var) >= 0) Append(Store_slot(reg, Promoted_slot(var)));
+  else Append(Global_access(mop_t::SW, reg, var));
 }
 
 // 访问 load 指令
-void Visit_load(const koopa_raw_load_t &load){
+void Visit_load(const koopa_raw_load_t &load, koopa_raw_value_t value){
   koopa_raw_value_t src = load.src;
-  std::string ident = src->name;
-  int load_src = value_ma[ident].val_t;
-  num_t tmpnum;
   switch (src->kind.tag){
-    case KOOPA_RVT_ALLOC:
-      printf("  lw    t0, %d(sp)\n", load_src);
-      printf("  sw    t0, %d(sp)\n", used);
-      tmpnum.num_val = used;
-      value_st.push(tmpnum);
-      used += 4;
-      break;
-    case KOOPA_RVT_GLOBAL_ALLOC:
+    case KOOPA_RVT_ALLOC: case KOOPA_RVT_GLOBAL_ALLOC:
+      Load_var(Value_reg(value), src);
       break;
     default:
       break;
@@ -453,35 +394,10 @@ void Visit_load(const koopa_raw_load_t &load){
 
 // 访问 store 指令
 void Visit_store(const koopa_raw_store_t &store){
-  koopa_raw_value_t value = store.value;
   koopa_raw_value_t dest = store.dest;
-  std::string ident = dest->name;
-  int store_dest = 0;
-  sym_t tmpsym;
-  num_t tmpnum;
-  if (!value_ma.count(ident)){
-    store_dest = used;
-    tmpsym.val_t = used;
-    value_ma[ident] = tmpsym;
-    used += 4;
-  }
-  else{
-    store_dest = value_ma[ident].val_t;
-  }
-  switch (value->kind.tag){
-    // 数字
-    case KOOPA_RVT_INTEGER:
-      printf("  li    t0, ");
-      Visit_integer(value->kind.data.integer);
-      printf("\n");
-      printf("  sw    t0, %d(sp)\n", store_dest);
-      break;
-    // 运算结果
-    case KOOPA_RVT_BINARY:
-      tmpnum = value_st.top();
-      value_st.pop();
-      printf("  lw    t0, %d(sp)\n", tmpnum.num_val);
-      printf("  sw    t0, %d(sp)\n", store_dest);
+  switch (dest->kind.tag){
+    case KOOPA_RVT_ALLOC: case KOOPA_RVT_GLOBAL_ALLOC:
+      Store_var(Value_reg(store.value), dest);
       break;
     default:
       assert(false);
@@ -489,54 +405,166 @@ void Visit_store(const koopa_raw_store_t &store){
   }
 }
 
-// 访问 branch
+// 访问 branch, 条件为真跳到 true_bb, 否则跳到 false_bb
 void Visit_branch(const koopa_raw_branch_t &branch){
-
+  minst_t inst = Minst(mop_t::BNEZ, NOREG, Value_reg(branch.cond));
+  inst.target = Edge_target(branch.true_bb);
+  Append(inst);
+  inst = Minst(mop_t::J);
+  inst.target = Edge_target(branch.false_bb);
+  Append(inst);
 }
 
 // 访问 jump
 void Visit_jump(const koopa_raw_jump_t &jump){
-
+  minst_t inst = Minst(mop_t::J);
+  inst.target = Edge_target(jump.target);
+  Append(inst);
 }
 
 // 访问 call
-void Visit_call(const koopa_raw_call_t &call){
-  
+// 前 8 个参数放在 a0~a7, 其余的依次放在栈顶, 返回值在 a0
+void Visit_call(const koopa_raw_call_t &call, koopa_raw_value_t value){
+  auto &func = ctx->func;
+  func.has_call = true;
+  int n = call.args.len;
+  for (int i = 0; i < n; ++i){
+    int reg = Value_reg(reinterpret_cast<koopa_raw_value_t>(call.args.buffer[i]));
+    if (i < ARG_REGS) Append(Minst(mop_t::MV, A0 + i, reg));
+    else Append(Minst(mop_t::SW, NOREG, SP, reg, (i - ARG_REGS) * 4));
+  }
+  func.out_args = std::max(func.out_args, (n - ARG_REGS) * 4);
+  minst_t inst = Minst(mop_t::CALL, NOREG, NOREG, NOREG, std::min(n, ARG_REGS));
+  inst.sym = call.callee->name + 1;
+  Append(inst);
+  if (value->ty->tag != KOOPA_RTT_UNIT) Append(Minst(mop_t::MV, Value_reg(value), A0));
+}
+
+// call 之后紧跟着 ret, 并且返回的就是 call 的结果 (或者不返回值) 时是尾调用
+// 调用其他函数时参数要全部放在寄存器里, 栈上的参数会覆盖调用者的栈帧
+// 实参指向本函数的局部变量时不是尾调用: 栈帧被拆掉 (或者被下一轮循环复用) 后指针就失效了
+bool Is_tail_call(koopa_raw_value_t value, koopa_raw_value_t next){
+  if (value->kind.tag != KOOPA_RVT_CALL || next->kind.tag != KOOPA_RVT_RETURN) return false;
+  koopa_raw_value_t ret_value = next->kind.data.ret.value;
+  if (ret_value != nullptr && ret_value != value) return false;
+  const auto &call = value->kind.data.call;
+  for (size_t i = 0; i < call.args.len; ++i){
+    auto arg = reinterpret_cast<koopa_raw_value_t>(call.args.buffer[i]);
+    if (arg->ty->tag == KOOPA_RTT_POINTER && points_to_local(arg)) return false;
+  }
+  return call.callee == ctx->self || call.args.len <= (size_t)ARG_REGS;
+}
+
+// 访问尾调用
+// 调用自己时把实参赋给形参所在的虚拟寄存器, 再跳回入口块, 递归变成循环;
+// 调用其他函数时参数放进 a0~a7, 拆掉栈帧后直接 tail 过去, 被调用者返回到本函数的调用者
+void Visit_tail_call(const koopa_raw_call_t &call){
+  Write_back(nullptr);
+  int n = call.args.len;
+  std::vector<int> args(n);
+  for (int i = 0; i < n; ++i){
+    args[i] = Value_reg(reinterpret_cast<koopa_raw_value_t>(call.args.buffer[i]));
+  }
+  if (call.callee == ctx->self){
+    // 实参可能就是形参, 先全部复制出来再赋值
+    for (int i = 0; i < n; ++i){
+      int tmp = ctx->func.New_reg();
+      Append(Minst(mop_t::MV, tmp, args[i]));
+      args[i] = tmp;
+    }
+    for (int i = 0; i < n; ++i) Append(Minst(mop_t::MV, ctx->params[i], args[i]));
+    minst_t inst = Minst(mop_t::J);
+    inst.target = 1;
+    Append(inst);
+    return;
+  }
+  for (int i = 0; i < n; ++i) Append(Minst(mop_t::MV, A0 + i, args[i]));
+  minst_t inst = Minst(mop_t::TAIL, NOREG, NOREG, NOREG, n);
+  inst.sym = call.callee->name + 1;
+  Append(inst);
 }
 
 // 访问 return 指令
 void Visit_ret(const koopa_raw_return_t &ret){
+  Write_back(nullptr);
   koopa_raw_value_t ret_value = ret.value;
-  num_t tmp_num;
-  switch (ret_value->kind.tag){
-    // 直接返回数字
-    case KOOPA_RVT_INTEGER:
-      printf("  li    a0, ");
-      Visit_integer(ret_value->kind.data.integer);
-      printf("\n");
-      printf("  addi  sp, sp, %d\n", sum_stack*4);
-      printf("  ret\n");
-      break;
-    // 返回运算结果
-    case KOOPA_RVT_BINARY:
-      tmp_num = value_st.top();
-      value_st.pop();
-      printf("  lw    a0, %d(sp)\n", tmp_num.num_val);
-      printf("  li    t0, %d\n", sum_stack*4);
-      printf("  add   sp, sp, t0\n");
-      printf("  ret\n");
-      break;
-    case KOOPA_RVT_LOAD:
-      tmp_num = value_st.top();
-      value_st.pop();
-      printf("  lw    a0, %d(sp)\n", tmp_num.num_val);
-      printf("  li    t0, %d\n", sum_stack*4);
-      printf("  add   sp, sp, t0\n");
-      printf("  ret\n");
-      break;
+  if (ret_value){
+    Append(Minst(mop_t::MV, A0, Value_reg(ret_value)));
+    Append(Minst(mop_t::RET, NOREG, NOREG, NOREG, 1));
+  }
+  else{
+    Append(Minst(mop_t::RET));
+  }
+}
+
+// 写内存之后, 和全局变量有关的结果失效; all 为真时 (经过指针写) 所有 load 也失效
+void Forget_memory(bool all){
+  auto &avail = ctx->avail;
+  for (auto it = avail.begin(); it != avail.end();){
+    if (it->second.global || (all && it->second.load)) it = avail.erase(it);
+    else ++it;
+  }
+}
+
+// 局部值编号
+// 同一个基本块里, 实参相同的无副作用 (或只读并且中间没有写全局变量) 的调用直接复用前一次的结果.
+// 地址相同并且中间没有写过的 load 值相同, 只用来判断实参是否相同; load 本身照常生成,
+// 寄存器分配后的窥孔优化会转发它, 在这里合并反而拉长虚拟寄存器的活跃范围.
+// 返回 true 表示 value 已经换成前一次的结果, 不需要再生成指令
+bool Number_value(koopa_raw_value_t value){
+  auto &avail = ctx->avail;
+  const auto &kind = value->kind;
+  vn_key_t key;
+  switch (kind.tag){
+    case KOOPA_RVT_LOAD: {
+      auto src = kind.data.load.src;
+      key.first = src;
+      auto it = avail.find(key);
+      if (it != avail.end()) ctx->same[value] = it->second.value;
+      else avail[key] = {value, true, src->kind.tag != KOOPA_RVT_ALLOC};
+      return false;
+    }
+    case KOOPA_RVT_STORE: {
+      // 忘掉可能被改写的 load, 写的不是局部变量时只读的调用也要重新计算
+      auto dest = kind.data.store.dest;
+      bool local = points_to_local(dest);
+      for (auto it = avail.begin(); it != avail.end();){
+        auto src = reinterpret_cast<koopa_raw_value_t>(it->first.first);
+        bool killed = it->second.load ? alias(src, dest) != alias_t::NO : it->second.global && !local;
+        if (killed) it = avail.erase(it);
+        else ++it;
+      }
+      return false;
+    }
+    case KOOPA_RVT_CALL: {
+      const auto &call = kind.data.call;
+      effect_t effect = effect_of(call.callee);
+      key.first = call.callee;
+      bool pointer = false;
+      for (size_t i = 0; i < call.args.len; ++i){
+        auto arg = reinterpret_cast<koopa_raw_value_t>(call.args.buffer[i]);
+        if (arg->ty->tag == KOOPA_RTT_POINTER) pointer = true;
+        auto it = ctx->same.find(arg);
+        if (it != ctx->same.end()) arg = it->second;
+        if (arg->kind.tag == KOOPA_RVT_INTEGER) key.second.push_back({0, arg->kind.data.integer.value});
+        else key.second.push_back({1, Value_reg(arg)});
+      }
+      // 传了指针的函数可能写调用者的数组
+      if (effect >= effect_t::WRITE || pointer){
+        Forget_memory(pointer);
+        return false;
+      }
+      if (value->ty->tag == KOOPA_RTT_UNIT) return false;
+      auto it = avail.find(key);
+      if (it != avail.end()){
+        ctx->value_reg[value] = Value_reg(it->second.value);
+        return true;
+      }
+      avail[key] = {value, false, effect == effect_t::READ};
+      return false;
+    }
     default:
-      assert(false);
-      break;
+      return false;
   }
 }
 
@@ -552,17 +580,17 @@ void Visit_inst(const koopa_raw_value_t &value){
     
     case KOOPA_RVT_ALLOC:
       // 访问 alloc 指令
-      Visit_alloc(kind.data.global_alloc);
+      Visit_alloc(value);
       break;
     
     case KOOPA_RVT_GLOBAL_ALLOC:
       // 访问 global alloc 指令
-      Visit_global_alloc(kind.data.global_alloc);
+      Visit_global_alloc(value);
       break;
 
     case KOOPA_RVT_LOAD:
       // 访问 load 指令
-      Visit_load(kind.data.load);
+      Visit_load(kind.data.load, value);
       break;
     
     case KOOPA_RVT_STORE:
@@ -582,12 +610,12 @@ void Visit_inst(const koopa_raw_value_t &value){
     
     case KOOPA_RVT_CALL:
       // 访问 call 指令
-      Visit_call(kind.data.call);
+      Visit_call(kind.data.call, value);
       break;
 
     case KOOPA_RVT_BINARY:
       // 访问 binary 指令
-      Visit_binary(kind.data.binary);
+      Visit_binary(kind.data.binary, value);
       break;
     
     case KOOPA_RVT_RETURN:
@@ -602,49 +630,590 @@ void Visit_inst(const koopa_raw_value_t &value){
   }
 }
 
+// 向量指令
+minst_t Vinst(mop_t op, int vd, int vs2 = -1, int vs1 = -1){
+  minst_t inst = Minst(op);
+  inst.vd = vd;
+  inst.vs2 = vs2;
+  inst.vs1 = vs1;
+  return inst;
+}
+
+minst_t Vsetvli(int rd, int avl, bool undisturbed){
+  return Minst(mop_t::VSETVLI, rd, avl, NOREG, undisturbed);
+}
+
+// 生成向量化的循环, 代替前置块里进入循环的 jump
+// 进入时已经不满足 iv < bound 就照常执行标量循环; 否则把剩下的 bound - iv 次迭代按 vl 分段,
+// 每段把 vl 个连续的 iv 放进向量, 算出各项加到累加向量上, 尾部元素保持不变.
+// 最后用 vredsum 把累加向量加到变量原来的值上, iv 置为 bound, 跳到循环的出口
+void Visit_vector(const vloop_t &loop){
+  auto &func = ctx->func;
+  int iv = func.New_reg(), bound = func.New_reg();
+  Load_var(iv, loop.iv);
+  if (loop.bound->kind.tag == KOOPA_RVT_INTEGER) Append(Minst(mop_t::LI, bound, NOREG, NOREG, loop.bound->kind.data.integer.value));
+  else Load_var(bound, loop.bound->kind.data.load.src);
+  int setup = New_block(), body = New_block(), tail = New_block();
+  minst_t inst = Minst(mop_t::BLT, NOREG, iv, bound);
+  inst.target = setup;
+  Append(inst);
+  inst = Minst(mop_t::J);
+  inst.target = Edge_target(loop.head);
+  Append(inst);
+
+  // 准备: 0, 1, 2, ... 的下标向量, 不变量和整数广播成向量, 累加向量清零
+  ctx->cur = setup;
+  int left = func.New_reg(), cur = func.New_reg(), vl = func.New_reg();
+  Append(Minst(mop_t::SUB, left, bound, iv));
+  Append(Vsetvli(func.New_reg(), ZERO, false));
+  int vregs = 1;
+  int vindex = vregs++, viv = vregs++;
+  Append(Vinst(mop_t::VID, vindex));
+  std::map<koopa_raw_value_t, int> vreg;
+  std::map<koopa_raw_value_t, int> splat_var;
+  std::map<int, int> splat_int;
+  auto splat = [&](int reg){
+    inst = Vinst(mop_t::VMV_V_X, vregs++);
+    inst.rs1 = reg;
+    Append(inst);
+    return inst.vd;
+  };
+  for (auto node : loop.nodes){
+    const auto &kind = node->kind;
+    if (kind.tag == KOOPA_RVT_LOAD && kind.data.load.src == loop.iv){
+      vreg[node] = viv;
+    }
+    else if (kind.tag == KOOPA_RVT_LOAD){
+      auto var = kind.data.load.src;
+      if (!splat_var.count(var)){
+        int reg = func.New_reg();
+        Load_var(reg, var);
+        splat_var[var] = splat(reg);
+      }
+      vreg[node] = splat_var[var];
+    }
+    else if (kind.tag == KOOPA_RVT_INTEGER){
+      int value = kind.data.integer.value;
+      if (!splat_int.count(value)){
+        int reg = func.New_reg();
+        Append(Minst(mop_t::LI, reg, NOREG, NOREG, value));
+        splat_int[value] = splat(reg);
+      }
+      vreg[node] = splat_int[value];
+    }
+    else{
+      vreg[node] = vregs++;
+    }
+  }
+  std::vector<int> vacc;
+  for (size_t k = 0; k < loop.accs.size(); ++k) vacc.push_back(splat(ZERO));
+  int vsum = vregs++;
+  assert(vregs <= 32);
+  Append(Minst(mop_t::MV, cur, iv));
+  inst = Minst(mop_t::J);
+  inst.target = body;
+  Append(inst);
+
+  // 每一段
+  ctx->cur = body;
+  Append(Vsetvli(vl, left, true));
+  inst = Vinst(mop_t::VADD_VX, viv, vindex);
+  inst.rs1 = cur;
+  Append(inst);
+  for (auto node : loop.nodes){
+    if (node->kind.tag != KOOPA_RVT_BINARY) continue;
+    const auto &binary = node->kind.data.binary;
+    mop_t op;
+    switch (binary.op){
+      case KOOPA_RBO_ADD: op = mop_t::VADD_VV; break;
+      case KOOPA_RBO_SUB: op = mop_t::VSUB_VV; break;
+      case KOOPA_RBO_MUL: op = mop_t::VMUL_VV; break;
+      case KOOPA_RBO_DIV: op = mop_t::VDIV_VV; break;
+      default: op = mop_t::VREM_VV; break;
+    }
+    Append(Vinst(op, vreg[node], vreg[binary.lhs], vreg[binary.rhs]));
+  }
+  for (size_t k = 0; k < loop.accs.size(); ++k){
+    for (auto &term : loop.accs[k].second){
+      Append(Vinst(term.second > 0 ? mop_t::VADD_VV : mop_t::VSUB_VV, vacc[k], vacc[k], vreg[term.first]));
+    }
+  }
+  Append(Minst(mop_t::ADD, cur, cur, vl));
+  Append(Minst(mop_t::SUB, left, left, vl));
+  inst = Minst(mop_t::BNEZ, NOREG, left);
+  inst.target = body;
+  Append(inst);
+  inst = Minst(mop_t::J);
+  inst.target = tail;
+  Append(inst);
+
+  // 归约, 写回变量
+  ctx->cur = tail;
+  Append(Vsetvli(func.New_reg(), ZERO, false));
+  for (size_t k = 0; k < loop.accs.size(); ++k){
+    auto var = loop.accs[k].first;
+    int init = func.New_reg(), sum = func.New_reg();
+    Load_var(init, var);
+    inst = Vinst(mop_t::VMV_S_X, vsum);
+    inst.rs1 = init;
+    Append(inst);
+    Append(Vinst(mop_t::VREDSUM_VS, vsum, vacc[k], vsum));
+    inst = Vinst(mop_t::VMV_X_S, -1, vsum);
+    inst.rd = sum;
+    Append(inst);
+    Store_var(sum, var);
+  }
+  Store_var(bound, loop.iv);
+  inst = Minst(mop_t::J);
+  inst.target = Edge_target(loop.exit);
+  Append(inst);
+}
+
 // 访问基本块
 void Visit_block(const koopa_raw_basic_block_t &bb){
-  // 执行一些其他的必要操作
-  // ...
+  ctx->cur = ctx->block_id[bb];
+  ctx->cur_bb = bb;
+  ctx->avail.clear();
+  auto hoist = ctx->hoist.find(bb);
+  auto promote = ctx->promote_load.find(bb);
+  auto vector = ctx->vector.find(bb);
   // 访问所有指令
   for (size_t i = 0; i < bb->insts.len; ++i){
       auto ptr = bb->insts.buffer[i];
-      Visit_inst(reinterpret_cast<koopa_raw_value_t>(ptr));
+      auto value = reinterpret_cast<koopa_raw_value_t>(ptr);
+      // 外提到这里的指令和提升的全局变量的装入放在块末尾的 jump 之前
+      if (i + 1 == bb->insts.len && hoist != ctx->hoist.end()){
+        for (auto inst : hoist->second){
+          if (!Number_value(inst)) Visit_inst(inst);
+        }
+      }
+      if (i + 1 == bb->insts.len && promote != ctx->promote_load.end()){
+        for (auto &p : promote->second){
+          int reg = ctx->func.New_reg();
+          Append(Global_access(mop_t::LW, reg, p.global));
+          Append(Store_slot(reg, p.slot));
+        }
+      }
+      if (ctx->hoisted.count(value) || Number_value(value)) continue;
+      if (i + 1 == bb->insts.len && vector != ctx->vector.end()){
+        Visit_vector(vector->second);
+        continue;
+      }
+      if (i + 1 < bb->insts.len && Is_tail_call(value, reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[i + 1]))){
+        Visit_tail_call(value->kind.data.call);
+        ++i;
+        continue;
+      }
+      Visit_inst(value);
   }
 }
 
-// 计算栈帧
-int Cal_block(const koopa_raw_basic_block_t &bb){
-  int tmp = 0;
-  // std::cout << "bbs.len = " << bb->insts.len << std::endl;
-  for (size_t i = 0; i < bb->insts.len; ++i){
-    auto ptr = bb->insts.buffer[i];
-    const koopa_raw_value_t &inst = reinterpret_cast<koopa_raw_value_t>(ptr);
-    if (inst->ty->tag != KOOPA_RTT_UNIT) tmp++;
+// 基本块结束指令的跳转目标
+std::vector<koopa_raw_basic_block_t> Block_targets(koopa_raw_basic_block_t bb){
+  if (bb->insts.len == 0) return {};
+  auto last = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 1]);
+  if (last->kind.tag == KOOPA_RVT_JUMP) return {last->kind.data.jump.target};
+  if (last->kind.tag == KOOPA_RVT_BRANCH) return {last->kind.data.branch.true_bb, last->kind.data.branch.false_bb};
+  return {};
+}
+
+// 函数的控制流图和其中的循环
+// 跳回前面 (或自身) 的边是回边, 目标是循环头, 文本上从循环头到回边所在的块都属于循环.
+// 循环头唯一的外部前驱只有一条 jump 时 (while 旋转后的 while_pre) 把它当作前置块
+struct loop_t {
+  int head, latch, pre;
+};
+
+struct cfg_t {
+  std::vector<koopa_raw_basic_block_t> bbs;
+  std::map<koopa_raw_basic_block_t, int> index;
+  // 指令所在的基本块
+  std::map<koopa_raw_value_t, int> def;
+  // 有前置块的循环, 按循环头的顺序排列, 外层循环在内层循环之前
+  std::vector<loop_t> loops;
+};
+
+void Find_loops(const koopa_raw_function_t &func, cfg_t &cfg){
+  int n = func->bbs.len;
+  auto &bbs = cfg.bbs;
+  bbs.resize(n);
+  for (int i = 0; i < n; ++i){
+    bbs[i] = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    cfg.index[bbs[i]] = i;
+    for (size_t j = 0; j < bbs[i]->insts.len; ++j) cfg.def[reinterpret_cast<koopa_raw_value_t>(bbs[i]->insts.buffer[j])] = i;
+  }
+  std::vector<std::vector<int>> preds(n);
+  std::vector<int> latch(n, -1);
+  for (int i = 0; i < n; ++i){
+    for (auto target : Block_targets(bbs[i])){
+      int t = cfg.index[target];
+      preds[t].push_back(i);
+      if (t <= i) latch[t] = std::max(latch[t], i);
+    }
+  }
+
+  for (int h = 0; h < n; ++h){
+    int l = latch[h], pre = -1, outside = 0;
+    if (l < 0) continue;
+    for (int p : preds[h]){
+      if (p < h || p > l){
+        outside++;
+        pre = p;
+      }
+    }
+    if (outside == 1 && bbs[pre]->insts.len == 1) cfg.loops.push_back({h, l, pre});
   }
-  return tmp;
 }
 
-// 访问函数
-void Visit_func(const koopa_raw_function_t &func){
-  // 执行一些其他的必要操作
-  std::cout << "main:" << std::endl;
+// 循环不变的调用外提
+// 循环头里实参都不变的无副作用调用 (只读的调用还要求循环里不写全局变量), 连同算实参的 load 和运算一起移到前置块.
+// 进入前置块后循环头至少执行一次, 外提不会多执行调用; 这里假定无副作用的函数总会返回
+void Plan_hoist(const cfg_t &cfg){
+  auto &bbs = cfg.bbs;
+  auto &def = cfg.def;
+  for (auto &loop : cfg.loops){
+    int h = loop.head, l = loop.latch, pre = loop.pre;
+    // 循环里 store 的地址, 是否可能写全局变量, 是否有调用可能经过指针写局部数组
+    std::vector<koopa_raw_value_t> stores;
+    bool clobber = false, clobber_all = false;
+    for (int b = h; b <= l; ++b){
+      for (size_t j = 0; j < bbs[b]->insts.len; ++j){
+        const auto &kind = reinterpret_cast<koopa_raw_value_t>(bbs[b]->insts.buffer[j])->kind;
+        if (kind.tag == KOOPA_RVT_STORE){
+          stores.push_back(kind.data.store.dest);
+          if (!points_to_local(kind.data.store.dest)) clobber = true;
+        }
+        else if (kind.tag == KOOPA_RVT_CALL){
+          const auto &call = kind.data.call;
+          if (effect_of(call.callee) >= effect_t::WRITE) clobber = true;
+          for (size_t k = 0; k < call.args.len; ++k){
+            if (reinterpret_cast<koopa_raw_value_t>(call.args.buffer[k])->ty->tag == KOOPA_RTT_POINTER) clobber_all = true;
+          }
+        }
+      }
+    }
+    // load 的值在循环里不变: 没有可能重叠的 store, 也没有调用可能写它
+    auto unchanged = [&](koopa_raw_value_t src){
+      for (auto dest : stores){
+        if (alias(src, dest) != alias_t::NO) return false;
+      }
+      if (src->kind.tag == KOOPA_RVT_ALLOC) return true;
+      return points_to_local(src) ? !clobber_all : !clobber;
+    };
 
-  // 访问所有基本块
+    // 循环头里的不变量, 以及要外提的指令
+    std::set<koopa_raw_value_t> inv;
+    std::vector<koopa_raw_value_t> plan;
+    auto invariant = [&](koopa_raw_value_t value){
+      if (value->kind.tag == KOOPA_RVT_INTEGER || inv.count(value)) return true;
+      auto it = def.find(value);
+      return it == def.end() || it->second < h || it->second > l;
+    };
+    // 外提一条指令之前先外提它用到的循环头里的不变量
+    std::function<void(koopa_raw_value_t)> take = [&](koopa_raw_value_t value){
+      if (!inv.count(value) || ctx->hoisted.count(value)) return;
+      const auto &kind = value->kind;
+      if (kind.tag == KOOPA_RVT_BINARY){
+        take(kind.data.binary.lhs);
+        take(kind.data.binary.rhs);
+      }
+      else if (kind.tag == KOOPA_RVT_CALL){
+        for (size_t k = 0; k < kind.data.call.args.len; ++k) take(reinterpret_cast<koopa_raw_value_t>(kind.data.call.args.buffer[k]));
+      }
+      ctx->hoisted.insert(value);
+      plan.push_back(value);
+    };
+    // 纯函数也可能不终止或者出错 (例如除零), 循环头里在它之前已经有输入输出或者写全局变量时,
+    // 提到前面会改变可观察的行为, 这之后的调用都不外提
+    bool effect_before = false;
+    for (size_t j = 0; j < bbs[h]->insts.len; ++j){
+      auto value = reinterpret_cast<koopa_raw_value_t>(bbs[h]->insts.buffer[j]);
+      const auto &kind = value->kind;
+      if (kind.tag == KOOPA_RVT_STORE){
+        if (!points_to_local(kind.data.store.dest)) effect_before = true;
+      }
+      else if (kind.tag == KOOPA_RVT_LOAD){
+        auto src = kind.data.load.src;
+        if (invariant(src) && unchanged(src)) inv.insert(value);
+      }
+      else if (kind.tag == KOOPA_RVT_BINARY){
+        if (invariant(kind.data.binary.lhs) && invariant(kind.data.binary.rhs)) inv.insert(value);
+      }
+      else if (kind.tag == KOOPA_RVT_CALL){
+        effect_t effect = effect_of(kind.data.call.callee);
+        if (effect >= effect_t::WRITE) effect_before = true;
+        if (effect_before || value->ty->tag == KOOPA_RTT_UNIT) continue;
+        if (effect != effect_t::PURE && (effect != effect_t::READ || clobber)) continue;
+        bool ok = true;
+        for (size_t k = 0; k < kind.data.call.args.len; ++k){
+          auto arg = reinterpret_cast<koopa_raw_value_t>(kind.data.call.args.buffer[k]);
+          if (!invariant(arg) || arg->ty->tag == KOOPA_RTT_POINTER) ok = false;
+        }
+        if (!ok) continue;
+        inv.insert(value);
+        take(value);
+      }
+    }
+    if (!plan.empty()){
+      auto &list = ctx->hoist[bbs[pre]];
+      list.insert(list.end(), plan.begin(), plan.end());
+    }
+  }
+}
+
+// 分配寄存器, 做窥孔优化, 布局栈帧, 调度, 最后输出汇编
+void Lower_func(mfunc_t &func){
+  alloc_regs(func);
+  peephole(func);
+  layout_frame(func);
+  schedule(func);
+  emit_func(func, ctx->out);
+}
+
+// -O3 时记忆化的函数: 无副作用, 直接调用自己, 返回 int, 参数都是 int 并且都放在寄存器里
+bool Memoizable(const koopa_raw_function_t &func){
+  if (opt_level < 3 || effect_of(func) != effect_t::PURE) return false;
+  if (func->ty->data.function.ret->tag != KOOPA_RTT_INT32) return false;
+  if (func->params.len == 0 || func->params.len > (size_t)ARG_REGS) return false;
+  for (size_t i = 0; i < func->params.len; ++i){
+    if (reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i])->ty->tag != KOOPA_RTT_INT32) return false;
+  }
   for (size_t i = 0; i < func->bbs.len; ++i){
-    auto ptr = func->bbs.buffer[i];
-    sum_stack += Cal_block(reinterpret_cast<koopa_raw_basic_block_t>(ptr));
-    // std::cout << "sum_stack = " << sum_stack << std::endl;
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    for (size_t j = 0; j < bb->insts.len; ++j){
+      auto value = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+      if (value->kind.tag == KOOPA_RVT_CALL && value->kind.data.call.callee == func) return true;
+    }
+  }
+  return false;
+}
+
+// 记忆化: 先输出 .bss 里的表和包装函数, 函数体改名为 <name>.body
+void Visit_memo(const koopa_raw_function_t &func, std::string &name){
+  std::string table = name + ".memo";
+  mfunc_t wrapper;
+  wrapper.name = name;
+  int size = memo_wrapper(wrapper, name + ".body", table, func->params.len);
+  emit("  .section .bss,\"aw\",@nobits\n");
+  emit("  .align 2\n");
+  emit("%s:\n", table.c_str());
+  emit("  .zero %d\n", size);
+  emit("  .text\n");
+  Lower_func(wrapper);
+  name += ".body";
+}
+
+// 全局变量的标量提升
+// 循环里没有读写全局变量的调用时, 循环里访问的全局变量在前置块装入一个栈槽, 循环里改为访问这个栈槽,
+// 离开循环的边上和循环里的返回之前再写回; 之后窥孔优化可以像局部变量一样转发和删除这些访问.
+// SysY 不能取标量的地址, 经过指针的写不会改到全局标量. 外层循环已经提升的全局变量, 内层循环不再提升
+void Plan_promote(const cfg_t &cfg){
+  auto &bbs = cfg.bbs;
+  for (auto &loop : cfg.loops){
+    bool ok = true;
+    std::map<koopa_raw_value_t, bool> globals;
+    for (int b = loop.head; b <= loop.latch && ok; ++b){
+      for (size_t j = 0; j < bbs[b]->insts.len; ++j){
+        const auto &kind = reinterpret_cast<koopa_raw_value_t>(bbs[b]->insts.buffer[j])->kind;
+        if (kind.tag == KOOPA_RVT_CALL && effect_of(kind.data.call.callee) != effect_t::PURE) ok = false;
+        else if (kind.tag == KOOPA_RVT_LOAD && kind.data.load.src->kind.tag == KOOPA_RVT_GLOBAL_ALLOC) globals[kind.data.load.src] |= false;
+        else if (kind.tag == KOOPA_RVT_STORE && kind.data.store.dest->kind.tag == KOOPA_RVT_GLOBAL_ALLOC) globals[kind.data.store.dest] = true;
+      }
+    }
+    if (!ok) continue;
+    ctx->cur_bb = bbs[loop.head];
+    for (auto &item : globals){
+      if (item.first->ty->data.pointer.base->tag != KOOPA_RTT_INT32 || Promoted_slot(item.first) >= 0) continue;
+      promote_t p = {item.first, ctx->func.New_slot(4), item.second};
+      ctx->promote_load[bbs[loop.pre]].push_back(p);
+      for (int b = loop.head; b <= loop.latch; ++b) ctx->promoted[bbs[b]].push_back(p);
+    }
+  }
+  ctx->cur_bb = nullptr;
+}
+
+// 计数循环的向量化
+// 只看 while 旋转后由循环体和条件两个块组成的循环: 条件是 iv < bound, 循环体里只有标量变量的 load, 运算和 store.
+// iv 每次加 1; 其余写到的变量都是 "a = a + 项 - 项 ..." 的形式, 项只由 iv, 循环里不变的变量和整数经过加减乘除模得到.
+// 这样各次迭代的项互不依赖, 整数加法 (溢出时回绕) 可以按任意顺序求和, 向量化后结果和标量循环完全相同;
+// 除以 0 和溢出时向量除法的结果也和标量的 div/rem 一致. 前端还不支持数组, 能处理的是对归纳变量的归约
+bool Is_var(koopa_raw_value_t value){
+  auto tag = value->kind.tag;
+  return (tag == KOOPA_RVT_ALLOC || tag == KOOPA_RVT_GLOBAL_ALLOC) && value->ty->data.pointer.base->tag == KOOPA_RTT_INT32;
+}
+
+bool Plan_vector_loop(const cfg_t &cfg, const loop_t &loop, vloop_t &plan){
+  if (loop.latch != loop.head + 1) return false;
+  auto body = cfg.bbs[loop.head], latch = cfg.bbs[loop.latch];
+  auto inst = [](koopa_raw_basic_block_t bb, size_t i){ return reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[i]); };
+
+  // 条件块: iv < bound, 其余只有没用到的 load
+  auto br = inst(latch, latch->insts.len - 1);
+  if (br->kind.tag != KOOPA_RVT_BRANCH || br->kind.data.branch.true_bb != body) return false;
+  auto cond = br->kind.data.branch.cond;
+  if (cond->kind.tag != KOOPA_RVT_BINARY || cond->kind.data.binary.op != KOOPA_RBO_LT) return false;
+  auto lhs = cond->kind.data.binary.lhs, rhs = cond->kind.data.binary.rhs;
+  if (lhs->kind.tag != KOOPA_RVT_LOAD || !Is_var(lhs->kind.data.load.src)) return false;
+  if (rhs->kind.tag != KOOPA_RVT_INTEGER && (rhs->kind.tag != KOOPA_RVT_LOAD || !Is_var(rhs->kind.data.load.src))) return false;
+  for (size_t i = 0; i < latch->insts.len; ++i){
+    auto value = inst(latch, i);
+    bool unused = value->kind.tag == KOOPA_RVT_LOAD && value->used_by.len == 0;
+    if (value != br && value != cond && value != lhs && value != rhs && !unused) return false;
+  }
+  plan.head = body;
+  plan.exit = br->kind.data.branch.false_bb;
+  plan.iv = lhs->kind.data.load.src;
+  plan.bound = rhs;
+
+  // 循环体: 每个变量至多写一次, 值只在循环体里使用
+  auto last = inst(body, body->insts.len - 1);
+  if (last->kind.tag != KOOPA_RVT_JUMP || last->kind.data.jump.target != latch) return false;
+  std::map<koopa_raw_value_t, size_t> pos, store_pos;
+  std::map<koopa_raw_value_t, koopa_raw_value_t> stored;
+  for (size_t i = 0; i + 1 < body->insts.len; ++i){
+    auto value = inst(body, i);
+    const auto &kind = value->kind;
+    pos[value] = i;
+    for (size_t k = 0; k < value->used_by.len; ++k){
+      auto it = cfg.def.find(reinterpret_cast<koopa_raw_value_t>(value->used_by.buffer[k]));
+      if (it == cfg.def.end() || it->second != loop.head) return false;
+    }
+    if (kind.tag == KOOPA_RVT_LOAD){
+      if (!Is_var(kind.data.load.src)) return false;
+    }
+    else if (kind.tag == KOOPA_RVT_STORE){
+      auto dest = kind.data.store.dest;
+      if (!Is_var(dest) || stored.count(dest)) return false;
+      stored[dest] = kind.data.store.value;
+      store_pos[dest] = i;
+    }
+    else if (kind.tag != KOOPA_RVT_BINARY){
+      return false;
+    }
+  }
+  if (rhs->kind.tag == KOOPA_RVT_LOAD && stored.count(rhs->kind.data.load.src)) return false;
+
+  // iv = iv + 1, 用到的 iv 都在这之前读出
+  if (!stored.count(plan.iv)) return false;
+  auto step = stored[plan.iv];
+  if (step->kind.tag != KOOPA_RVT_BINARY || step->kind.data.binary.op != KOOPA_RBO_ADD) return false;
+  auto a = step->kind.data.binary.lhs, b = step->kind.data.binary.rhs;
+  if (a->kind.tag == KOOPA_RVT_INTEGER) std::swap(a, b);
+  if (a->kind.tag != KOOPA_RVT_LOAD || a->kind.data.load.src != plan.iv) return false;
+  if (b->kind.tag != KOOPA_RVT_INTEGER || b->kind.data.integer.value != 1) return false;
+  for (auto &item : pos){
+    auto value = item.first;
+    if (value->kind.tag == KOOPA_RVT_LOAD && value->kind.data.load.src == plan.iv &&
+        value->used_by.len > 0 && item.second > store_pos[plan.iv]) return false;
+  }
+
+  // 项能否逐元素计算, 同时按后序记下子表达式
+  std::set<koopa_raw_value_t> seen;
+  std::function<bool(koopa_raw_value_t)> element = [&](koopa_raw_value_t value){
+    if (seen.count(value)) return true;
+    const auto &kind = value->kind;
+    bool ok = false;
+    if (kind.tag == KOOPA_RVT_INTEGER){
+      ok = true;
+    }
+    else if (kind.tag == KOOPA_RVT_LOAD){
+      ok = pos.count(value) && (kind.data.load.src == plan.iv || !stored.count(kind.data.load.src));
+    }
+    else if (kind.tag == KOOPA_RVT_BINARY && pos.count(value)){
+      auto op = kind.data.binary.op;
+      ok = (op == KOOPA_RBO_ADD || op == KOOPA_RBO_SUB || op == KOOPA_RBO_MUL || op == KOOPA_RBO_DIV || op == KOOPA_RBO_MOD) &&
+           element(kind.data.binary.lhs) && element(kind.data.binary.rhs);
+    }
+    if (ok){
+      seen.insert(value);
+      plan.nodes.push_back(value);
+    }
+    return ok;
+  };
+
+  // 累加变量: 沿加减法展开, 恰好有一次以正号出现它自己原来的值
+  for (auto &item : stored){
+    auto var = item.first;
+    if (var == plan.iv) continue;
+    std::vector<std::pair<koopa_raw_value_t, int>> terms;
+    int plus = 0, minus = 0;
+    std::function<void(koopa_raw_value_t, int)> flatten = [&](koopa_raw_value_t value, int sign){
+      const auto &kind = value->kind;
+      if (kind.tag == KOOPA_RVT_LOAD && kind.data.load.src == var){
+        (sign > 0 ? plus : minus)++;
+      }
+      else if (kind.tag == KOOPA_RVT_BINARY && (kind.data.binary.op == KOOPA_RBO_ADD || kind.data.binary.op == KOOPA_RBO_SUB)){
+        flatten(kind.data.binary.lhs, sign);
+        flatten(kind.data.binary.rhs, kind.data.binary.op == KOOPA_RBO_ADD ? sign : -sign);
+      }
+      else{
+        terms.push_back({value, sign});
+      }
+    };
+    flatten(item.second, 1);
+    if (plus != 1 || minus != 0) return false;
+    for (auto &term : terms){
+      if (!element(term.first)) return false;
+    }
+    plan.accs.push_back({var, terms});
   }
-  sum_stack += 8;
+  if (plan.accs.empty()) return false;
 
-  printf("  li    t0, -%d\n", sum_stack*4);
-  printf("  add   sp, sp, t0\n");
+  // 向量寄存器: v0 留作掩码, 下标, iv, 每个子表达式, 每个累加变量, 以及归约用的一个
+  return 3 + plan.nodes.size() + plan.accs.size() + 1 <= 32;
+}
 
+void Plan_vector(const cfg_t &cfg){
+  if (!target_rvv) return;
+  for (auto &loop : cfg.loops){
+    vloop_t plan;
+    if (Plan_vector_loop(cfg, loop, plan)) ctx->vector[cfg.bbs[loop.pre]] = plan;
+  }
+}
+
+// 访问函数
+// 先做指令选择得到机器指令, 再分配寄存器, 做窥孔优化, 布局栈帧, 调度, 最后输出汇编
+void Visit_func(const koopa_raw_function_t &func){
+  // 函数声明没有基本块, 不需要生成代码
+  if (func->bbs.len == 0) return;
+  auto &mfunc = ctx->func;
+  mfunc.name = func->name + 1;
+  if (Memoizable(func)) Visit_memo(func, mfunc.name);
+  ctx->self = func;
+  // 0 号块只复制参数, 基本块从 1 开始编号; 尾递归跳回 1 号块, 形参的虚拟寄存器相当于它的块参数
+  for (size_t i = 0; i <= func->bbs.len; ++i){
+    if (i > 0) ctx->block_id[reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i - 1])] = i;
+    mfunc.blocks.emplace_back();
+    mfunc.blocks.back().label = ".L" + mfunc.name + "_" + std::to_string(i);
+  }
+
+  // 参数先复制到虚拟寄存器: 前 8 个在 a0~a7 中, 其余的在调用者的栈帧里
+  ctx->cur = 0;
+  for (size_t i = 0; i < func->params.len; ++i){
+    int reg = Value_reg(reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i]));
+    ctx->params.push_back(reg);
+    if ((int)i < ARG_REGS){
+      Append(Minst(mop_t::MV, reg, A0 + i));
+    }
+    else{
+      int slot = mfunc.New_slot(4);
+      mfunc.frame[slot].arg = i;
+      Append(Load_slot(reg, slot));
+    }
+  }
+
+  // 访问所有基本块
+  cfg_t cfg;
+  Find_loops(func, cfg);
+  Plan_hoist(cfg);
+  Plan_promote(cfg);
+  Plan_vector(cfg);
   for (size_t i = 0; i < func->bbs.len; ++i){
     auto ptr = func->bbs.buffer[i];
     Visit_block(reinterpret_cast<koopa_raw_basic_block_t>(ptr));
   }
+
+  Lower_func(mfunc);
 }
 
 // 访问 raw slice
@@ -672,19 +1241,83 @@ void Visit_slice(const koopa_raw_slice_t &slice){
   }
 }
 
+// 并行访问所有函数
+// 工作线程从共享计数器中领取下一个未处理的函数, 先做完的线程自动多领, 负载自然均衡
+// 全部完成后按源程序顺序拼接各函数的输出
+void Visit_funcs(const koopa_raw_slice_t &funcs, std::string &out){
+  std::vector<func_ctx_t> ctxs(funcs.len);
+  std::atomic<size_t> next(0);
+  auto worker = [&](){
+    size_t i;
+    while ((i = next.fetch_add(1)) < funcs.len){
+      auto func = reinterpret_cast<koopa_raw_function_t>(funcs.buffer[i]);
+      ctx = &ctxs[i];
+      // 函数没有变化时直接复用上次生成的汇编
+      auto it = func_key.find(func->name);
+      if (it != func_key.end() && cache_load(it->second, ctx->out)) continue;
+      Visit_func(func);
+      if (it != func_key.end()) cache_save(it->second, ctx->out);
+    }
+  };
+
+  size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+  jobs = std::min(jobs, (size_t)funcs.len);
+  std::vector<std::thread> pool;
+  for (size_t i = 1; i < jobs; ++i) pool.emplace_back(worker);
+  worker();
+  for (auto &t : pool) t.join();
+
+  for (auto &c : ctxs) out += c.out;
+}
+
 // 访问 raw program
-void Visit_pro(const koopa_raw_program_t &program){
+void Visit_pro(const koopa_raw_program_t &program, std::string &out){
   // 执行一些其他的必要操作
-  std::cout << "  .text" << std::endl;
-  std::cout << "  .global main" << std::endl;
+  func_ctx_t global_ctx;
+  ctx = &global_ctx;
+
+  // 调用的函数能否合并, 外提取决于它的副作用, 所以副作用也计入缓存键
+  analyze_effects(program);
+  unsigned long long effects = effects_hash();
+  for (auto &item : func_key) item.second = Hash_bytes(&effects, sizeof(effects), item.second);
 
   // 访问所有全局变量
   Visit_slice(program.values);
+  emit("  .text\n");
+  emit("  .global main\n");
+  out += global_ctx.out;
   // 访问所有函数
-  Visit_slice(program.funcs);
+  Visit_funcs(program.funcs, out);
+}
+
+// 把 IR 文本按函数切开, 计算每个函数的缓存键
+void Split_funcs(const char *str){
+  static const char salt[] = "riscv-func";
+  func_key.clear();
+  const char *p = str;
+  while ((p = strstr(p, "fun @")) != nullptr){
+    if (p != str && p[-1] != '\n'){
+      p += 5;
+      continue;
+    }
+    const char *name_end = strchr(p + 4, '(');
+    const char *end = strstr(p, "\n}\n");
+    if (name_end == nullptr || end == nullptr) break;
+    end += 3;
+    // 编译器标识和整体缓存键一致, 重新构建编译器后不复用旧的函数缓存
+    // 调度结果和目标核有关, 核的名字也计入缓存键; 优化级别和是否有向量扩展同样
+    unsigned long long h = Hash_bytes(salt, sizeof(salt), build_id());
+    h = Hash_bytes(core_name(), strlen(core_name()), h);
+    h = Hash_bytes(&opt_level, sizeof(opt_level), h);
+    h = Hash_bytes(&target_rvv, sizeof(target_rvv), h);
+    func_key[std::string(p + 4, name_end)] = Hash_bytes(p, end - p, h);
+    p = end;
+  }
 }
 
-void solve_koopa(char *str){
+// 生成的汇编写入 out
+void solve_koopa(const char *str, std::string &out){
+    if (cache_enabled()) Split_funcs(str);
     // 解析字符串 str, 得到 Koopa IR 程序
     koopa_program_t program;
     koopa_error_code_t ret = koopa_parse_from_string(str, &program);
@@ -697,7 +1330,7 @@ void solve_koopa(char *str){
     koopa_delete_program(program);
 
     // 处理 raw program
-    Visit_pro(raw);
+    Visit_pro(raw, out);
 
     // 处理完成, 释放 raw program builder 占用的内存
     // 注意, raw program 中所有的指针指向的内存均为 raw program builder 的内存
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "mir.hpp"
+
+// 指令调度
+// 目标是单发射顺序执行的核, 装入的值紧接着就被使用时流水线要停顿.
+// 在栈帧布局之后对每个基本块做表调度: 按依赖图上到块尾的最长延迟决定优先级,
+// 逐周期挑选已就绪的指令, 让 lw 提前, 无关的计算填进等待的周期里.
+// 调度前后用同一张延迟表在顺序流水线模型上估算周期数, 只在变快时采用新的顺序
+
+// 各种核的延迟, 单位是周期; 数字取自公开的微架构资料, 只是近似值
+struct core_t {
+  const char *name;
+  int alu;
+  int load;
+  int mul;
+  int div;
+  // 跳转, 调用和返回额外的周期
+  int branch;
+};
+
+static const core_t cores[] = {
+  {"generic", 1, 3, 3, 20, 2},
+  {"rocket", 1, 3, 4, 33, 3},
+  {"u74", 1, 3, 3, 34, 1},
+  {"c906", 1, 3, 4, 20, 2},
+};
+
+// 目标核由环境变量 SYSY_CORE 指定, 默认为 generic
+static const core_t &Target_core(){
+  static const core_t *core = [](){
+    const char *name = getenv("SYSY_CORE");
+    for (auto &c : cores){
+      if (name != nullptr && strcmp(name, c.name) == 0) return &c;
+    }
+    return &cores[0];
+  }();
+  return *core;
+}
+
+const char *core_name(){
+  return Target_core().name;
+}
+
+static int Latency(const core_t &core, mop_t op){
+  switch (op){
+    case mop_t::LW: return core.load;
+    case mop_t::MUL: return core.mul;
+    case mop_t::DIV: case mop_t::REM: return core.div;
+    default: return core.alu;
+  }
+}
+
+// 在顺序流水线模型上估算一段指令的周期数: 每周期至多发射一条, 操作数没有就绪时停顿
+static int Simulate(const core_t &core, const minst_t *insts, size_t n){
+  int ready[32] = {0};
+  int cycle = 0;
+  for (size_t i = 0; i < n; ++i){
+    auto &inst = insts[i];
+    int issue = cycle;
+    unsigned uses = Use_mask(inst);
+    for (int r = 1; r < 32; ++r){
+      if ((uses >> r & 1) && ready[r] > issue) issue = ready[r];
+    }
+    unsigned defs = Def_mask(inst);
+    for (int r = 1; r < 32; ++r){
+      if (defs >> r & 1) ready[r] = issue + Latency(core, inst.op);
+    }
+    cycle = issue + 1;
+    if (inst.op == mop_t::J || inst.op == mop_t::CALL || Is_exit(inst.op)) cycle += core.branch;
+  }
+  return cycle;
+}
+
+static bool Is_mem(mop_t op){
+  return op == mop_t::LW || op == mop_t::SW;
+}
+
+// 两次访存是否可能是同一个字: 都以 sp 为基址时比较偏移, 都是全局变量时比较名字,
+// 栈和全局变量互不重叠, 其他情况保守地认为可能
+static bool May_alias(const minst_t &a, const minst_t &b){
+  bool stack_a = a.rs1 == SP && a.sym.empty(), stack_b = b.rs1 == SP && b.sym.empty();
+  if (stack_a && stack_b) return a.imm == b.imm;
+  if (!a.sym.empty() && !b.sym.empty()) return a.sym == b.sym && a.imm == b.imm;
+  if ((stack_a && !b.sym.empty()) || (stack_b && !a.sym.empty())) return false;
+  return true;
+}
+
+// 一次调度的指令数上限, 依赖图的边数随它平方增长
+static const size_t REGION = 256;
+
+struct node_t {
+  std::vector<std::pair<int, int>> succ;
+  int preds = 0;
+  int prio = 0;
+  int earliest = 0;
+};
+
+// 调度 [begin, end) 中的指令, 其中没有 call, 向量指令和结束指令
+static void Schedule_region(const core_t &core, std::vector<minst_t> &insts, size_t begin, size_t end){
+  int n = end - begin;
+  if (n < 2) return;
+  const minst_t *code = insts.data() + begin;
+  std::vector<node_t> nodes(n);
+  auto edge = [&](int from, int to, int lat){
+    nodes[from].succ.push_back({to, lat});
+    nodes[to].preds++;
+  };
+
+  // 寄存器的读后写, 写后读, 写后写依赖
+  int last_def[32];
+  std::vector<int> uses_since[32];
+  for (int r = 0; r < 32; ++r) last_def[r] = -1;
+  for (int i = 0; i < n; ++i){
+    unsigned uses = Use_mask(code[i]), defs = Def_mask(code[i]);
+    for (int r = 1; r < 32; ++r){
+      if ((uses >> r & 1) && last_def[r] >= 0) edge(last_def[r], i, Latency(core, code[last_def[r]].op));
+    }
+    for (int r = 1; r < 32; ++r){
+      if (!(defs >> r & 1)) continue;
+      for (int u : uses_since[r]) if (u != i) edge(u, i, 0);
+      if (last_def[r] >= 0) edge(last_def[r], i, 1);
+    }
+    for (int r = 1; r < 32; ++r){
+      if (defs >> r & 1){
+        last_def[r] = i;
+        uses_since[r].clear();
+      }
+      if (uses >> r & 1) uses_since[r].push_back(i);
+    }
+    // 访存之间的依赖, 两次都是 lw 时可以交换
+    if (!Is_mem(code[i].op)) continue;
+    for (int j = 0; j < i; ++j){
+      if (!Is_mem(code[j].op)) continue;
+      if (code[i].op == mop_t::LW && code[j].op == mop_t::LW) continue;
+      if (May_alias(code[i], code[j])) edge(j, i, code[j].op == mop_t::SW ? 1 : 0);
+    }
+  }
+
+  // 优先级: 到区域末尾的最长延迟
+  for (int i = n - 1; i >= 0; --i){
+    nodes[i].prio = Latency(core, code[i].op);
+    for (auto &s : nodes[i].succ){
+      nodes[i].prio = std::max(nodes[i].prio, s.second + nodes[s.first].prio);
+    }
+  }
+
+  std::vector<int> ready;
+  for (int i = 0; i < n; ++i){
+    if (nodes[i].preds == 0) ready.push_back(i);
+  }
+  std::vector<minst_t> order;
+  order.reserve(n);
+  int cycle = 0;
+  while ((int)order.size() < n){
+    int pick = -1;
+    for (size_t k = 0; k < ready.size(); ++k){
+      int i = ready[k];
+      if (nodes[i].earliest > cycle) continue;
+      if (pick < 0 || nodes[i].prio > nodes[ready[pick]].prio ||
+          (nodes[i].prio == nodes[ready[pick]].prio && i < ready[pick])){
+        pick = k;
+      }
+    }
+    if (pick < 0){
+      cycle++;
+      continue;
+    }
+    int i = ready[pick];
+    ready.erase(ready.begin() + pick);
+    order.push_back(code[i]);
+    for (auto &s : nodes[i].succ){
+      auto &next = nodes[s.first];
+      next.earliest = std::max(next.earliest, cycle + s.second);
+      if (--next.preds == 0) ready.push_back(s.first);
+    }
+    cycle++;
+  }
+
+  if (Simulate(core, order.data(), n) < Simulate(core, code, n)){
+    std::copy(order.begin(), order.end(), insts.begin() + begin);
+  }
+}
+
+void schedule(mfunc_t &func){
+  const core_t &core = Target_core();
+  for (auto &bb : func.blocks){
+    auto &insts = bb.insts;
+    size_t begin = 0;
+    for (size_t i = 0; i <= insts.size(); ++i){
+      bool barrier = i == insts.size() || insts[i].op == mop_t::CALL || Is_terminator(insts[i].op) || Is_vector(insts[i].op);
+      if (!barrier && i - begin < REGION) continue;
+      Schedule_region(core, insts, begin, i);
+      begin = barrier ? i + 1 : i;
+    }
+  }
+}
@@ -0,0 +1,146 @@
+#include <cassert>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "ast.hpp"
+#include "sym.hpp"
+
+// 语义分析
+// 生成 IR 之前按源程序顺序遍历一次 AST, 把结果记在节点上:
+//   每个标识符解析到声明它的节点上的 sym_t, 生成 IR 时不再查符号表
+//   常量的值和全局变量的初值在这里求出, 生成 IR 时不再重复求值
+//   每条语句和每个块是否以 ret 结束, 生成 IR 时据此决定是否补 jump 和 ret
+// 符号表和原来生成 IR 时一样是一张扁平的表, 后出现的同名声明覆盖前面的
+
+struct sema_t {
+  std::map<std::string, const sym_t *> symbols;
+  // 所在函数的层数, 为 0 时是全局声明
+  int in_func = 0;
+};
+
+static const sym_t *Lookup(sema_t &sema, const std::string &ident){
+  auto it = sema.symbols.find(ident);
+  return it == sema.symbols.end() ? nullptr : it->second;
+}
+
+// 访问子节点之前: 函数和参数先声明, 函数体里才能引用 (包括递归调用)
+static void Enter(sema_t &sema, BaseAST *node){
+  switch (node->kind){
+    case ast_kind_t::FuncDef: {
+      auto ast = static_cast<FuncDefAST *>(node);
+      ast->sym.type = (ast->mode == 1 || ast->mode == 3) ? 2 : 3;
+      ast->sym.val_t = 0;
+      sema.symbols[ast->ident] = &ast->sym;
+      sema.in_func++;
+      break;
+    }
+    case ast_kind_t::FuncFParam: {
+      auto ast = static_cast<FuncFParamAST *>(node);
+      ast->sym.type = 5;
+      ast->sym.val_t = 0;
+      sema.symbols[ast->ident] = &ast->sym;
+      break;
+    }
+    case ast_kind_t::Stmt: {
+      auto ast = static_cast<StmtAST *>(node);
+      if (ast->mode == 1) ast->sym = Lookup(sema, ast->ident);
+      break;
+    }
+    case ast_kind_t::LVal: {
+      auto ast = static_cast<LValAST *>(node);
+      ast->sym = Lookup(sema, ast->ident);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+// 访问子节点之后: 常量和变量在初值之后才声明, 初值里引用的是外面的同名符号
+static void Leave(sema_t &sema, BaseAST *node, dump_ctx_t &ctx){
+  switch (node->kind){
+    case ast_kind_t::FuncDef:
+      sema.in_func--;
+      break;
+    case ast_kind_t::ConstDef: {
+      auto ast = static_cast<ConstDefAST *>(node);
+      if (ast->mode == 1){
+        ast->sym.val_t = ast->const_init_val->Cal(ctx);
+        ast->sym.type = 0;
+      }
+      else{
+        ast->sym.val_t = 0;
+        ast->sym.type = 6;
+        ast->sym.number = ast->const_exp_muti->Cal(ctx);
+      }
+      sema.symbols[ast->ident] = &ast->sym;
+      break;
+    }
+    case ast_kind_t::VarDef: {
+      auto ast = static_cast<VarDefAST *>(node);
+      if (ast->mode != 1 && ast->mode != 3) break;
+      ast->sym.type = 1;
+      ast->sym.val_t = 0;
+      if (ast->mode == 3 && sema.in_func == 0) ast->sym.val_t = ast->init_val->Cal(ctx);
+      sema.symbols[ast->ident] = &ast->sym;
+      break;
+    }
+    case ast_kind_t::Stmt: {
+      auto ast = static_cast<StmtAST *>(node);
+      ast->returns = ast->mode == 10 || ast->mode == 11 ||
+                     (ast->mode == 4 && Returns(ast->block.get()));
+      break;
+    }
+    case ast_kind_t::Block: {
+      auto ast = static_cast<BlockAST *>(node);
+      auto arr = static_cast<const BlockItemArrAST *>(ast->block_item_arr.get());
+      ast->returns = !arr->items.empty() && arr->items.back().first == 2 &&
+                     Returns(arr->items.back().second.get());
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+// 和 Dump_exp 一样用显式的栈遍历, 很深的表达式不会爆栈
+void analyze(BaseAST *root, dump_ctx_t &ctx){
+  sema_t sema;
+  for (auto &item : ctx.val_ma) sema.symbols[item.first] = &item.second;
+
+  struct frame_t {
+    BaseAST *node;
+    bool expanded;
+  };
+  std::vector<frame_t> work;
+  work.push_back({root, false});
+  while (!work.empty()){
+    BaseAST *node = work.back().node;
+    if (!work.back().expanded){
+      work.back().expanded = true;
+      Enter(sema, node);
+      size_t pos = work.size();
+      For_each_child(node, [&](const BaseAST *child){
+        work.push_back({const_cast<BaseAST *>(child), false});
+      });
+      // 表达式里的函数调用在这里解析, 变量 (LVal) 作为子节点继续访问
+      if (node->kind == ast_kind_t::Exp){
+        auto &pool = *ctx.pool;
+        For_each_ref(pool, static_cast<ExpAST *>(node)->root, [&](uint32_t ref){
+          if (pool.op[ref] == exp_op_t::CALL){
+            auto &call = pool.calls[pool.lhs[ref]];
+            call.sym = Lookup(sema, call.ident);
+          }
+          else{
+            work.push_back({pool.lvals[pool.lhs[ref]].get(), false});
+          }
+        });
+      }
+      std::reverse(work.begin() + pos, work.end());
+      continue;
+    }
+    work.pop_back();
+    Leave(sema, node, ctx);
+  }
+}
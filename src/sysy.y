@@ -2,6 +2,13 @@
   #include <memory>
   #include <string>
   #include "ast.hpp"
+
+  // 标识符在输入缓冲区中的位置和长度
+  // lexer 不再为每个标识符 new 一个 string, 而是直接指向 mmap 的输入
+  struct ident_t {
+    const char *ptr;
+    int len;
+  };
 }
 
 %{
@@ -11,46 +18,61 @@
 #include <string>
 #include "ast.hpp"
 
-// 声明 lexer 函数和错误处理函数
-int yylex();
-void yyerror(std::unique_ptr<BaseAST> &ast, const char *s);
-
 using namespace std;
 
+// 默认的解析栈深度上限只有 10000, 嵌套很深的括号表达式会报 memory exhausted
+// 解析栈按需倍增, 上限放宽到一千万
+#define YYMAXDEPTH 10000000
+
 %}
 
+// parser 和 lexer 都是可重入的, 状态保存在 scanner 里而不是全局变量中
+// 这样同一个进程里可以同时进行多次解析
+%define api.pure full
+%lex-param { void *scanner }
+
 // 定义 parser 函数和错误处理函数的附加参数
 // 我们需要返回一个字符串作为 AST, 所以我们把附加参数定义成字符串的智能指针
 // 解析完成后, 我们要手动修改这个参数, 把它设置成解析得到的字符串
-%parse-param { std::unique_ptr<BaseAST> &ast }
+// pool 存放所有表达式的节点, 表达式的产生式返回节点在其中的下标
+// scanner 是 lexer 的状态, 由 parser 原样传给 lexer
+%parse-param { std::unique_ptr<BaseAST> &ast } { exp_pool_t &pool } { void *scanner }
 
 // yylval 的定义, 我们把它定义成了一个联合体 (union)
-// 因为 token 的值有的是字符串指针, 有的是整数
-// 之前我们在 lexer 中用到的 str_val 和 int_val 就是在这里被定义的
-// 至于为什么要用字符串指针而不直接用 string 或者 unique_ptr<string>?
+// 因为 token 的值有的是标识符, 有的是整数
+// 之前我们在 lexer 中用到的 ident_val 和 int_val 就是在这里被定义的
+// 至于为什么不直接用 string 或者 unique_ptr<string>?
 // 请自行 STFW 在 union 里写一个带析构函数的类会出现什么情况
 %union {
-  std::string *str_val;
+  ident_t ident_val;
   int int_val;
   BaseAST *ast_val;
+  uint32_t exp_val;
+}
+
+%code {
+// 声明 lexer 函数和错误处理函数
+int yylex(YYSTYPE *yylval, void *scanner);
+void yyerror(std::unique_ptr<BaseAST> &ast, exp_pool_t &pool, void *scanner, const char *s);
 }
 
 // lexer 返回的所有 token 种类的声明
-// 注意 IDENT 和 INT_CONST 会返回 token 的值, 分别对应 str_val 和 int_val
+// 注意 IDENT 和 INT_CONST 会返回 token 的值, 分别对应 ident_val 和 int_val
 %token INT RETURN CONST VOID IF ELSE WHILE BREAK CONTINUE
 %token LE GE EQ NE AND OR
-%token <str_val> IDENT
+%token <ident_val> IDENT
 %token <int_val> INT_CONST
 
 // 非终结符的类型定义
-%type <ast_val> CompUnit FuncDef Block Stmt
-%type <ast_val> Exp PrimaryExp UnaryExp MulExp AddExp
-%type <ast_val> RelExp EqExp LAndExp LOrExp
+%type <ast_val> CompUnit FuncDef Block Stmt Exp
 %type <ast_val> Decl ConstDecl ConstDefArr ConstDef
 %type <ast_val> LVal BlockItemArr ConstInitVal ConstExp
 %type <ast_val> VarDecl VarDefArr VarDef InitVal
-%type <ast_val> FuncFParamArr FuncFParam FuncRParamArr FuncRParam
+%type <ast_val> FuncFParamArr FuncFParam
 %type <ast_val> ConstInitValArr ConstExpMuti InitValArr ExpMuti
+// 表达式节点在 pool 中的下标; FuncRParamArr 是调用在 pool.calls 中的下标
+%type <exp_val> PrimaryExp UnaryExp MulExp AddExp
+%type <exp_val> RelExp EqExp LAndExp LOrExp FuncRParamArr
 %type <int_val> Number
 
 %%
@@ -74,28 +96,22 @@ TreeHead
 CompUnit
   : FuncDef {
     auto ast = new CompUnitAST();
-    ast->func_def = unique_ptr<BaseAST>($1);
-    ast->mode = 1;
+    ast->units.emplace_back(1, unique_ptr<BaseAST>($1));
     $$ = ast;
   }
   | Decl {
     auto ast = new CompUnitAST();
-    ast->decl = unique_ptr<BaseAST>($1);
-    ast->mode = 2;
+    ast->units.emplace_back(2, unique_ptr<BaseAST>($1));
     $$ = ast;
   }
   | CompUnit FuncDef {
-    auto ast = new CompUnitAST();
-    ast->comp_unit = unique_ptr<BaseAST>($1);
-    ast->func_def = unique_ptr<BaseAST>($2);
-    ast->mode = 3;
+    auto ast = static_cast<CompUnitAST *>($1);
+    ast->units.emplace_back(1, unique_ptr<BaseAST>($2));
     $$ = ast;
   }
   | CompUnit Decl {
-    auto ast = new CompUnitAST();
-    ast->comp_unit = unique_ptr<BaseAST>($1);
-    ast->decl = unique_ptr<BaseAST>($2);
-    ast->mode = 4;
+    auto ast = static_cast<CompUnitAST *>($1);
+    ast->units.emplace_back(2, unique_ptr<BaseAST>($2));
     $$ = ast;
   }
   ;
@@ -128,16 +144,13 @@ ConstDecl
 // ConstDefArr ::= ConstDefArr "," ConstDef | ConstDef
 ConstDefArr
   : ConstDefArr ',' ConstDef {
-    auto ast = new ConstDefArrAST();
-    ast->const_def_arr = unique_ptr<BaseAST>($1);
-    ast->const_def = unique_ptr<BaseAST>($3);
-    ast->mode = 1;
+    auto ast = static_cast<ConstDefArrAST *>($1);
+    ast->const_defs.push_back(unique_ptr<BaseAST>($3));
     $$ = ast;
   }
   | ConstDef {
     auto ast = new ConstDefArrAST();
-    ast->const_def = unique_ptr<BaseAST>($1);
-    ast->mode = 2;
+    ast->const_defs.push_back(unique_ptr<BaseAST>($1));
     $$ = ast;
   }
   ;
@@ -147,14 +160,14 @@ ConstDefArr
 ConstDef
   : IDENT '=' ConstInitVal {
     auto ast = new ConstDefAST();
-    ast->ident = *unique_ptr<string>($1);
+    ast->ident = string($1.ptr, $1.len);
     ast->const_init_val = unique_ptr<BaseAST>($3);
     ast->mode = 1;
     $$ = ast;
   }
   | IDENT ConstExpMuti '=' ConstInitVal {
     auto ast = new ConstDefAST();
-    ast->ident = *unique_ptr<string>($1);
+    ast->ident = string($1.ptr, $1.len);
     ast->const_exp_muti = unique_ptr<BaseAST>($2);
     ast->const_init_val = unique_ptr<BaseAST>($4);
     ast->mode = 2;
@@ -204,15 +217,12 @@ ConstInitVal
 ConstInitValArr
   : ConstInitVal {
     auto ast = new ConstInitValArrAST();
-    ast->const_init_val = unique_ptr<BaseAST>($1);
-    ast->mode = 1;
+    ast->const_init_vals.push_back(unique_ptr<BaseAST>($1));
     $$ = ast;
   }
   | ConstInitValArr ',' ConstInitVal {
-    auto ast = new ConstInitValArrAST();
-    ast->const_init_val_arr = unique_ptr<BaseAST>($1);
-    ast->const_init_val = unique_ptr<BaseAST>($3);
-    ast->mode = 2;
+    auto ast = static_cast<ConstInitValArrAST *>($1);
+    ast->const_init_vals.push_back(unique_ptr<BaseAST>($3));
     $$ = ast;
   }
   ;
@@ -229,16 +239,13 @@ VarDecl
 // VarDefArr ::= VarDefArr "," VarDef | VarDef
 VarDefArr
   : VarDefArr ',' VarDef {
-    auto ast = new VarDefArrAST();
-    ast->var_def_arr = unique_ptr<BaseAST>($1);
-    ast->var_def = unique_ptr<BaseAST>($3);
-    ast->mode = 1;
+    auto ast = static_cast<VarDefArrAST *>($1);
+    ast->var_defs.push_back(unique_ptr<BaseAST>($3));
     $$ = ast;
   }
   | VarDef {
     auto ast = new VarDefArrAST();
-    ast->var_def = unique_ptr<BaseAST>($1);
-    ast->mode = 2;
+    ast->var_defs.push_back(unique_ptr<BaseAST>($1));
     $$ = ast;
   }
   ;
@@ -248,27 +255,27 @@ VarDefArr
 VarDef
   : IDENT {
     auto ast = new VarDefAST();
-    ast->ident = *unique_ptr<string>($1);
+    ast->ident = string($1.ptr, $1.len);
     ast->mode = 1;
     $$ = ast;
   }
   | IDENT ConstExpMuti {
     auto ast = new VarDefAST();
-    ast->ident = *unique_ptr<string>($1);
+    ast->ident = string($1.ptr, $1.len);
     ast->const_exp_muti = unique_ptr<BaseAST>($2);
     ast->mode = 2;
     $$ = ast;
   }
   | IDENT '=' InitVal {
     auto ast = new VarDefAST();
-    ast->ident = *unique_ptr<string>($1);
+    ast->ident = string($1.ptr, $1.len);
     ast->init_val = unique_ptr<BaseAST>($3);
     ast->mode = 3;
     $$ = ast;
   }
   | IDENT ConstExpMuti '=' InitVal {
     auto ast = new VarDefAST();
-    ast->ident = *unique_ptr<string>($1);
+    ast->ident = string($1.ptr, $1.len);
     ast->const_exp_muti = unique_ptr<BaseAST>($2);
     ast->init_val = unique_ptr<BaseAST>($4);
     ast->mode = 4;
@@ -301,15 +308,12 @@ InitVal
 InitValArr
   : InitVal {
     auto ast = new InitValArrAST();
-    ast->init_val = unique_ptr<BaseAST>($1);
-    ast->mode = 1;
+    ast->init_vals.push_back(unique_ptr<BaseAST>($1));
     $$ = ast;
   }
   | InitValArr ',' InitVal {
-    auto ast = new InitValArrAST();
-    ast->init_val_arr = unique_ptr<BaseAST>($1);
-    ast->init_val = unique_ptr<BaseAST>($3);
-    ast->mode = 2;
+    auto ast = static_cast<InitValArrAST *>($1);
+    ast->init_vals.push_back(unique_ptr<BaseAST>($3));
     $$ = ast;
   }
   ;
@@ -332,21 +336,21 @@ InitValArr
 FuncDef
   : INT IDENT '(' ')' Block {
     auto ast = new FuncDefAST();
-    ast->ident = *unique_ptr<string>($2);
+    ast->ident = string($2.ptr, $2.len);
     ast->block = unique_ptr<BaseAST>($5);
     ast->mode = 1;
     $$ = ast;  
   }
   | VOID IDENT '(' ')' Block {
     auto ast = new FuncDefAST();
-    ast->ident = *unique_ptr<string>($2);
+    ast->ident = string($2.ptr, $2.len);
     ast->block = unique_ptr<BaseAST>($5);
     ast->mode = 2;
     $$ = ast;  
   }
   | INT IDENT '(' FuncFParamArr ')' Block {
     auto ast = new FuncDefAST();
-    ast->ident = *unique_ptr<string>($2);
+    ast->ident = string($2.ptr, $2.len);
     ast->func_fparam_arr = unique_ptr<BaseAST>($4);
     ast->block = unique_ptr<BaseAST>($6);
     ast->mode = 3;
@@ -354,7 +358,7 @@ FuncDef
   }
   | VOID IDENT '(' FuncFParamArr ')' Block {
     auto ast = new FuncDefAST();
-    ast->ident = *unique_ptr<string>($2);
+    ast->ident = string($2.ptr, $2.len);
     ast->func_fparam_arr = unique_ptr<BaseAST>($4);
     ast->block = unique_ptr<BaseAST>($6);
     ast->mode = 4;
@@ -365,16 +369,13 @@ FuncDef
 // FuncFParamArr ::= FuncFParamArr "," FuncFParam | FuncFParam
 FuncFParamArr
   : FuncFParamArr ',' FuncFParam {
-    auto ast = new FuncFParamArrAST();
-    ast->func_fparam_arr = unique_ptr<BaseAST>($1);
-    ast->func_fparam = unique_ptr<BaseAST>($3);
-    ast->mode = 1;
+    auto ast = static_cast<FuncFParamArrAST *>($1);
+    ast->func_fparams.push_back(unique_ptr<BaseAST>($3));
     $$ = ast;
   }
   | FuncFParam {
     auto ast = new FuncFParamArrAST();
-    ast->func_fparam = unique_ptr<BaseAST>($1);
-    ast->mode = 2;
+    ast->func_fparams.push_back(unique_ptr<BaseAST>($1));
     $$ = ast;
   }
   ;
@@ -383,7 +384,7 @@ FuncFParamArr
 FuncFParam
   : INT IDENT {
     auto ast = new FuncFParamAST();
-    ast->ident = *unique_ptr<string>($2);
+    ast->ident = string($2.ptr, $2.len);
     $$ = ast;
   }
   ;
@@ -400,25 +401,20 @@ Block
 // BlockItemArr ::= BlockItemArr Decl | BlockItemArr Stmt | 
 BlockItemArr
   : BlockItemArr Decl {
-    auto ast = new BlockItemArrAST();
-    ast->block_item_arr = unique_ptr<BaseAST>($1);
-    ast->decl = unique_ptr<BaseAST>($2);
-    ast->mode = 1;
+    auto ast = static_cast<BlockItemArrAST *>($1);
+    ast->items.emplace_back(1, unique_ptr<BaseAST>($2));
     $$ = ast;
   }
   | BlockItemArr Stmt {
-    auto ast = new BlockItemArrAST();
-    ast->block_item_arr = unique_ptr<BaseAST>($1);
-    ast->stmt = unique_ptr<BaseAST>($2);
-    ast->mode = 2;
+    auto ast = static_cast<BlockItemArrAST *>($1);
+    ast->items.emplace_back(2, unique_ptr<BaseAST>($2));
     $$ = ast;
   }
   | {
     auto ast = new BlockItemArrAST();
-    ast->mode = 3;
     $$ = ast;
   }
-  ; 
+  ;
 
 // Stmt ::= LVal "=" Exp ";"
 //        | ";"
@@ -434,7 +430,7 @@ BlockItemArr
 Stmt
   : IDENT '=' Exp ';' {
     auto ast = new StmtAST();
-    ast->ident = *unique_ptr<string>($1);
+    ast->ident = string($1.ptr, $1.len);
     ast->exp = unique_ptr<BaseAST>($3);
     ast->mode = 1;
     $$ = ast;
@@ -505,7 +501,7 @@ Stmt
 Exp
   : LOrExp {
     auto ast = new ExpAST();
-    ast->lor_exp = unique_ptr<BaseAST>($1);
+    ast->root = $1;
     $$ = ast;
   }
   ;
@@ -514,13 +510,13 @@ Exp
 LVal
   : IDENT {
     auto ast = new LValAST();
-    ast->ident = *unique_ptr<string>($1);
+    ast->ident = string($1.ptr, $1.len);
     ast->mode = 1;
     $$ = ast;
   }
   | IDENT ExpMuti {
     auto ast = new LValAST();
-    ast->ident = *unique_ptr<string>($1);
+    ast->ident = string($1.ptr, $1.len);
     ast->exp_muti = unique_ptr<BaseAST>($2);
     ast->mode = 2;
     $$ = ast;
@@ -545,24 +541,16 @@ ExpMuti
   ;
 
 // PrimaryExp ::= "(" Exp ")" | LVal | Number
+// 括号不生成节点, 直接返回里面的表达式
 PrimaryExp
-  : '(' Exp ')' {
-    auto ast = new PrimaryExpAST();
-    ast->exp = unique_ptr<BaseAST>($2);
-    ast->mode = 1;
-    $$ = ast;
+  : '(' LOrExp ')' {
+    $$ = $2;
   }
   | LVal {
-    auto ast = new PrimaryExpAST();
-    ast->lval = unique_ptr<BaseAST>($1);
-    ast->mode = 2;
-    $$ = ast;
+    $$ = pool.Add_lval(static_cast<LValAST *>($1));
   }
   | Number {
-    auto ast = new PrimaryExpAST();
-    ast->number = $1;
-    ast->mode = 3;
-    $$ = ast;
+    $$ = pool.Add(exp_op_t::NUMBER, (uint32_t)$1);
   }
   ;
 
@@ -580,218 +568,120 @@ Number
 //            | ("+" | "-" | "!") UnaryExp
 UnaryExp
   : PrimaryExp {
-    auto ast = new UnaryExpAST();
-    ast->primary_exp = unique_ptr<BaseAST>($1);
-    ast->mode = 1;
-    $$ = ast;
+    $$ = $1;
   }
   | IDENT '(' ')' {
-    auto ast = new UnaryExpAST();
-    ast->ident = *unique_ptr<string>($1);
-    ast->mode = 2;
-    $$ = ast;  
+    uint32_t call = pool.Add_call();
+    pool.calls[call].ident = string($1.ptr, $1.len);
+    $$ = pool.Add(exp_op_t::CALL, call);
   }
   | IDENT '(' FuncRParamArr ')' {
-    auto ast = new UnaryExpAST();
-    ast->ident = *unique_ptr<string>($1);
-    ast->func_rparam_arr = unique_ptr<BaseAST>($3);
-    ast->mode = 3;
-    $$ = ast;  
+    pool.calls[$3].ident = string($1.ptr, $1.len);
+    $$ = pool.Add(exp_op_t::CALL, $3);
   }
   | '+' UnaryExp {
-    auto ast = new UnaryExpAST();
-    ast->unary_exp = unique_ptr<BaseAST>($2);
-    ast->mode = 4;
-    $$ = ast;
+    $$ = $2;
   }
   | '-' UnaryExp {
-    auto ast = new UnaryExpAST();
-    ast->unary_exp = unique_ptr<BaseAST>($2);
-    ast->mode = 5;
-    $$ = ast;
+    $$ = pool.Add(exp_op_t::NEG, $2);
   }
   | '!' UnaryExp {
-    auto ast = new UnaryExpAST();
-    ast->unary_exp = unique_ptr<BaseAST>($2);
-    ast->mode = 6;
-    $$ = ast;
+    $$ = pool.Add(exp_op_t::NOT, $2);
   }
   ;
 
 // FuncRParamArr ::= FuncRParamArr "," FuncRParam | FuncRParam
+// FuncRParam ::= Exp
 FuncRParamArr
-  : FuncRParamArr ',' FuncRParam {
-    auto ast = new FuncRParamArrAST();
-    ast->func_rparam_arr = unique_ptr<BaseAST>($1);
-    ast->func_rparam = unique_ptr<BaseAST>($3);
-    ast->mode = 1;
-    $$ = ast;
+  : FuncRParamArr ',' LOrExp {
+    pool.calls[$1].args.push_back($3);
+    $$ = $1;
   }
-  | FuncRParam {
-    auto ast = new FuncRParamArrAST();
-    ast->func_rparam = unique_ptr<BaseAST>($1);
-    ast->mode = 2;
-    $$ = ast;
-  }
-  ;
-
-// FuncRParam ::= Exp
-FuncRParam
-  : Exp {
-    auto ast = new FuncRParamAST();
-    ast->exp = unique_ptr<BaseAST>($1);
-    $$ = ast;
+  | LOrExp {
+    uint32_t call = pool.Add_call();
+    pool.calls[call].args.push_back($1);
+    $$ = call;
   }
   ;
 
 // MulExp ::= UnaryExp | MulExp ("*" | "/" | "%") UnaryExp
 MulExp
   : UnaryExp {
-    auto ast = new MulExpAST();
-    ast->unary_exp = unique_ptr<BaseAST>($1);
-    ast->mode = 1;
-    $$ = ast;
+    $$ = $1;
   }
   | MulExp '*' UnaryExp {
-    auto ast = new MulExpAST();
-    ast->mul_exp = unique_ptr<BaseAST>($1);
-    ast->unary_exp = unique_ptr<BaseAST>($3);
-    ast->mode = 2;
-    $$ = ast;
+    $$ = pool.Add(exp_op_t::MUL, $1, $3);
   }
   | MulExp '/' UnaryExp {
-    auto ast = new MulExpAST();
-    ast->mul_exp = unique_ptr<BaseAST>($1);
-    ast->unary_exp = unique_ptr<BaseAST>($3);
-    ast->mode = 3;
-    $$ = ast;
+    $$ = pool.Add(exp_op_t::DIV, $1, $3);
   }
   | MulExp '%' UnaryExp {
-    auto ast = new MulExpAST();
-    ast->mul_exp = unique_ptr<BaseAST>($1);
-    ast->unary_exp = unique_ptr<BaseAST>($3);
-    ast->mode = 4;
-    $$ = ast;
+    $$ = pool.Add(exp_op_t::MOD, $1, $3);
   }
   ;
 
 // AddExp ::= MulExp | AddExp ("+" | "-") MulExp
 AddExp
   : MulExp {
-    auto ast = new AddExpAST();
-    ast->mul_exp = unique_ptr<BaseAST>($1);
-    ast->mode = 1;
-    $$ = ast;
+    $$ = $1;
   }
   | AddExp '+' MulExp {
-    auto ast = new AddExpAST();
-    ast->add_exp = unique_ptr<BaseAST>($1);
-    ast->mul_exp = unique_ptr<BaseAST>($3);
-    ast->mode = 2;
-    $$ = ast;
+    $$ = pool.Add(exp_op_t::ADD, $1, $3);
   }
   | AddExp '-' MulExp {
-    auto ast = new AddExpAST();
-    ast->add_exp = unique_ptr<BaseAST>($1);
-    ast->mul_exp = unique_ptr<BaseAST>($3);
-    ast->mode = 3;
-    $$ = ast;
+    $$ = pool.Add(exp_op_t::SUB, $1, $3);
   }
   ;
 
 // RelExp ::= AddExp | RelExp ("<" | ">" | "<=" | ">=") AddExp
 RelExp
   : AddExp {
-    auto ast = new RelExpAST();
-    ast->add_exp = unique_ptr<BaseAST>($1);
-    ast->mode = 1;
-    $$ = ast;
+    $$ = $1;
   }
   | RelExp '<' AddExp {
-    auto ast = new RelExpAST();
-    ast->rel_exp = unique_ptr<BaseAST>($1);
-    ast->add_exp = unique_ptr<BaseAST>($3);
-    ast->mode = 2;
-    $$ = ast;
+    $$ = pool.Add(exp_op_t::LT, $1, $3);
   }
   | RelExp '>' AddExp {
-    auto ast = new RelExpAST();
-    ast->rel_exp = unique_ptr<BaseAST>($1);
-    ast->add_exp = unique_ptr<BaseAST>($3);
-    ast->mode = 3;
-    $$ = ast;
+    $$ = pool.Add(exp_op_t::GT, $1, $3);
   }
   | RelExp LE AddExp {
-    auto ast = new RelExpAST();
-    ast->rel_exp = unique_ptr<BaseAST>($1);
-    ast->add_exp = unique_ptr<BaseAST>($3);
-    ast->mode = 4;
-    $$ = ast;
+    $$ = pool.Add(exp_op_t::LE, $1, $3);
   }
   | RelExp GE AddExp {
-    auto ast = new RelExpAST();
-    ast->rel_exp = unique_ptr<BaseAST>($1);
-    ast->add_exp = unique_ptr<BaseAST>($3);
-    ast->mode = 5;
-    $$ = ast;
+    $$ = pool.Add(exp_op_t::GE, $1, $3);
   }
   ;
 
 // EqExp ::= RelExp | EqExp ("==" | "!=") RelExp
 EqExp
   : RelExp {
-    auto ast = new EqExpAST();
-    ast->rel_exp = unique_ptr<BaseAST>($1);
-    ast->mode = 1;
-    $$ = ast;
+    $$ = $1;
   }
   | EqExp EQ RelExp {
-    auto ast = new EqExpAST();
-    ast->eq_exp = unique_ptr<BaseAST>($1);
-    ast->rel_exp = unique_ptr<BaseAST>($3);
-    ast->mode = 2;
-    $$ = ast;
+    $$ = pool.Add(exp_op_t::EQ, $1, $3);
   }
   | EqExp NE RelExp {
-    auto ast = new EqExpAST();
-    ast->eq_exp = unique_ptr<BaseAST>($1);
-    ast->rel_exp = unique_ptr<BaseAST>($3);
-    ast->mode = 3;
-    $$ = ast;
+    $$ = pool.Add(exp_op_t::NE, $1, $3);
   }
   ;
 
 // LAndExp ::= EqExp | LAndExp "&&" EqExp
 LAndExp
   : EqExp {
-    auto ast = new LAndExpAST();
-    ast->eq_exp = unique_ptr<BaseAST>($1);
-    ast->mode = 1;
-    $$ = ast;
+    $$ = $1;
   }
   | LAndExp AND EqExp {
-    auto ast = new LAndExpAST();
-    ast->land_exp = unique_ptr<BaseAST>($1);
-    ast->eq_exp = unique_ptr<BaseAST>($3);
-    ast->mode = 2;
-    $$ = ast;
+    $$ = pool.Add(exp_op_t::AND, $1, $3);
   }
   ;
 
 // LOrExp ::= LAndExp | LOrExp "||" LAndExp
 LOrExp
   : LAndExp {
-    auto ast = new LOrExpAST();
-    ast->land_exp = unique_ptr<BaseAST>($1);
-    ast->mode = 1;
-    $$ = ast;
+    $$ = $1;
   }
   | LOrExp OR LAndExp {
-    auto ast = new LOrExpAST();
-    ast->lor_exp = unique_ptr<BaseAST>($1);
-    ast->land_exp = unique_ptr<BaseAST>($3);
-    ast->mode = 2;
-    $$ = ast;
+    $$ = pool.Add(exp_op_t::OR, $1, $3);
   }
   ;
 
@@ -808,6 +698,6 @@ ConstExp
 
 // 定义错误处理函数, 其中第二个参数是错误信息
 // parser 如果发生错误 (例如输入的程序出现了语法错误), 就会调用这个函数
-void yyerror(unique_ptr<BaseAST> &ast, const char *s) {
+void yyerror(unique_ptr<BaseAST> &ast, exp_pool_t &pool, void *scanner, const char *s) {
   cerr << "error: " << s << endl;
 }
@@ -0,0 +1,98 @@
+#pragma once
+#include <cstdarg>
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+
+// 输出缓冲区
+// 生成的代码先格式化进一大块缓冲区, 攒够一块再用一次 write 写出, 不经过 stdio/iostream
+struct writer_t{
+  static const size_t CHUNK = 1 << 20;
+
+  int fd;
+  std::string buf;
+  bool ok = true;
+
+  explicit writer_t(int fd) : fd(fd) { buf.reserve(CHUNK); }
+  ~writer_t() { flush(); }
+
+  void put(const char *data, size_t len){
+    // 很大的一段直接写出, 不必先拷进缓冲区
+    if (len >= CHUNK){
+      flush();
+      Write_all(data, len);
+      return;
+    }
+    buf.append(data, len);
+    if (buf.size() >= CHUNK) flush();
+  }
+
+  void put(const std::string &str){
+    put(str.data(), str.size());
+  }
+
+  bool flush(){
+    Write_all(buf.data(), buf.size());
+    buf.clear();
+    return ok;
+  }
+
+  private:
+    void Write_all(const char *data, size_t len){
+      while (len > 0 && ok){
+        ssize_t n = write(fd, data, len);
+        if (n <= 0){
+          ok = false;
+          break;
+        }
+        data += n;
+        len -= n;
+      }
+    }
+};
+
+// 只支持 %d, %s 和 %% 的格式化, 直接追加到 out 后面
+// 后端每条指令都要格式化一次, 比 vsnprintf 少了解析格式和区域设置的开销
+// 遇到其他格式时退回 vsnprintf
+inline void Format(std::string &out, const char *fmt, va_list args){
+  va_list copy1, copy2;
+  va_copy(copy1, args);
+  va_copy(copy2, args);
+  size_t start = out.size();
+  const char *p = fmt;
+  while (*p){
+    const char *q = p;
+    while (*q && *q != '%') ++q;
+    out.append(p, q - p);
+    if (*q == '\0') break;
+    if (q[1] == 'd'){
+      int val = va_arg(args, int);
+      char num[12];
+      char *e = num + sizeof(num), *s = e;
+      unsigned u = val < 0 ? 0u - (unsigned)val : (unsigned)val;
+      do{
+        *--s = '0' + u % 10;
+        u /= 10;
+      } while (u);
+      if (val < 0) *--s = '-';
+      out.append(s, e - s);
+    }
+    else if (q[1] == 's'){
+      out += va_arg(args, const char *);
+    }
+    else if (q[1] == '%'){
+      out += '%';
+    }
+    else{
+      out.resize(start);
+      int len = vsnprintf(nullptr, 0, fmt, copy1);
+      out.resize(start + len + 1);
+      vsnprintf(&out[start], len + 1, fmt, copy2);
+      out.resize(start + len);
+      break;
+    }
+    p = q + 2;
+  }
+  va_end(copy1);
+  va_end(copy2);
+}